@@ -0,0 +1,124 @@
+#include "FileWatch.hpp"
+
+#include <iostream>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+#if !defined(__linux__)
+//modification time (in whatever units the platform gives) and size of a file (returns false if it doesn't exist):
+static bool get_stamp(std::string const &path, int64_t *mtime, int64_t *size) {
+	#if defined(_WIN32)
+	struct _stat64 info;
+	if (_stat64(path.c_str(), &info) != 0) return false;
+	#else
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0) return false;
+	#endif
+	#if defined(__APPLE__)
+	*mtime = int64_t(info.st_mtimespec.tv_sec) * 1000000000 + int64_t(info.st_mtimespec.tv_nsec);
+	#else
+	*mtime = int64_t(info.st_mtime); //(one-second resolution, so quick same-size rewrites can be missed)
+	#endif
+	*size = int64_t(info.st_size);
+	return true;
+}
+#endif
+
+FileWatch::FileWatch() {
+	#if defined(__linux__)
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0) {
+		std::cerr << "WARNING: inotify_init1 failed (" << std::strerror(errno) << "); file changes won't be noticed." << std::endl;
+	}
+	#endif
+}
+
+FileWatch::~FileWatch() {
+	#if defined(__linux__)
+	if (inotify_fd >= 0) close(inotify_fd); //(also removes all watches)
+	#endif
+}
+
+void FileWatch::watch(std::string const &path, std::function< void() > const &on_change) {
+	files.emplace_back();
+	File &file = files.back();
+	file.path = path;
+	file.on_change = on_change;
+
+	size_t slash = path.find_last_of("/\\");
+	if (slash == std::string::npos) {
+		file.directory = ".";
+		file.name = path;
+	} else {
+		file.directory = path.substr(0, slash);
+		file.name = path.substr(slash + 1);
+	}
+
+	#if defined(__linux__)
+	if (inotify_fd >= 0) {
+		//watch the directory rather than the file, since exporters and editors often replace files by renaming over them:
+		// (watching the same directory twice returns the same descriptor)
+		file.watch_descriptor = inotify_add_watch(inotify_fd, file.directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (file.watch_descriptor < 0) {
+			std::cerr << "WARNING: can't watch '" << file.directory << "' (" << std::strerror(errno) << "); changes to '" << path << "' won't be noticed." << std::endl;
+		}
+	}
+	#else
+	if (!get_stamp(file.path, &file.mtime, &file.size)) {
+		file.mtime = file.size = -1;
+	}
+	#endif
+}
+
+void FileWatch::poll() {
+	#if defined(__linux__)
+	if (inotify_fd >= 0) {
+		//read all pending events:
+		alignas(inotify_event) char buffer[4096];
+		while (true) {
+			ssize_t got = read(inotify_fd, buffer, sizeof(buffer));
+			if (got <= 0) break; //(EAGAIN => no more events)
+			for (char *at = buffer; at < buffer + got; /* later */) {
+				inotify_event const &event = *reinterpret_cast< inotify_event const * >(at);
+				at += sizeof(inotify_event) + event.len;
+				if (event.len == 0) continue;
+				std::string name(event.name); //(name is padded with '\0's)
+				for (auto &file : files) {
+					if (file.watch_descriptor == event.wd && file.name == name) file.changed = true;
+				}
+			}
+		}
+	}
+	#else
+	for (auto &file : files) {
+		int64_t mtime = -1, size = -1;
+		if (!get_stamp(file.path, &mtime, &size)) continue; //(a file that is missing is probably in the middle of being replaced)
+		if (mtime != file.mtime || size != file.size) {
+			file.mtime = mtime;
+			file.size = size;
+			file.changed = true;
+		}
+	}
+	#endif
+
+	//call change functions:
+	// (flags are cleared first, and functions copied, in case a function throws or watches more files)
+	std::vector< std::function< void() > > to_call;
+	for (auto &file : files) {
+		if (file.changed) {
+			file.changed = false;
+			to_call.emplace_back(file.on_change);
+		}
+	}
+	for (auto const &fn : to_call) {
+		fn();
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+/*
+ * FileWatch notices when files change on disk (e.g., when an asset is
+ * re-exported), so that code can reload them without restarting.
+ *
+ * Usage:
+ *   FileWatch watch;
+ *   watch.watch(data_path("level.scene"), [&](){ ...reload... });
+ *   //each frame:
+ *   watch.poll(); //calls the functions of any files that changed
+ *
+ * On Linux, changes are reported by inotify (watching each file's directory,
+ * so files that are replaced by renaming are noticed too). Elsewhere, poll()
+ * compares modification times and sizes.
+ *
+ */
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct FileWatch {
+	FileWatch();
+	~FileWatch();
+
+	//(owns an inotify handle, so copying is not allowed)
+	FileWatch(FileWatch const &) = delete;
+	FileWatch &operator=(FileWatch const &) = delete;
+
+	//call 'on_change' (from poll()) whenever the file at 'path' is written or replaced:
+	void watch(std::string const &path, std::function< void() > const &on_change);
+
+	//check for changes and call on_change for each file that changed since the last poll():
+	// (several writes to a file between polls result in one call; exceptions thrown by on_change propagate)
+	void poll();
+
+	//-- internals --
+	struct File {
+		std::string path;
+		std::string directory; //directory containing the file ("." if none in path)
+		std::string name; //file name within directory
+		std::function< void() > on_change;
+		int watch_descriptor = -1; //inotify watch on 'directory' (Linux)
+		int64_t mtime = -1; //modification time when last checked (elsewhere; -1 => missing)
+		int64_t size = -1; //size when last checked (elsewhere)
+		bool changed = false;
+	};
+	std::vector< File > files;
+
+	int inotify_fd = -1; //(Linux)
+};
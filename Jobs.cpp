@@ -0,0 +1,89 @@
+#include "Jobs.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+Jobs::Jobs(uint32_t thread_count) {
+	threads.reserve(thread_count);
+	for (uint32_t i = 0; i < thread_count; ++i) {
+		threads.emplace_back(&Jobs::thread_main, this, i + 1); //(worker 0 is the calling thread)
+	}
+}
+
+Jobs::~Jobs() {
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		quit = true;
+	}
+	start_cv.notify_all();
+	for (auto &thread : threads) {
+		thread.join();
+	}
+}
+
+Jobs &Jobs::shared() {
+	static Jobs jobs(std::max(1U, std::thread::hardware_concurrency()) - 1);
+	return jobs;
+}
+
+void Jobs::parallel_for(uint32_t count_, uint32_t grain_, Job const &job_) {
+	if (count_ == 0) return;
+	grain_ = std::max(grain_, 1U);
+
+	//small loops aren't worth waking anyone for:
+	if (count_ <= grain_ || threads.empty()) {
+		job_(0, count_, 0);
+		return;
+	}
+
+	std::unique_lock< std::mutex > call_lock(call_mutex);
+
+	{ //publish the loop and wake the pool:
+		std::unique_lock< std::mutex > lock(mutex);
+		assert(active == 0);
+		job = &job_;
+		count = count_;
+		grain = grain_;
+		next = 0;
+		active = uint32_t(threads.size());
+		generation += 1;
+	}
+	start_cv.notify_all();
+
+	//help out:
+	work(0);
+
+	{ //wait for the pool (every pool thread checks in, so none can still be looking at 'job' after this):
+		std::unique_lock< std::mutex > lock(mutex);
+		done_cv.wait(lock, [this](){ return active == 0; });
+		job = nullptr;
+	}
+}
+
+void Jobs::work(uint32_t worker) {
+	while (true) {
+		uint32_t begin = next.fetch_add(grain);
+		if (begin >= count) break;
+		(*job)(begin, std::min(begin + grain, count), worker);
+	}
+}
+
+void Jobs::thread_main(uint32_t worker) {
+	uint32_t seen = 0; //generation last worked on
+	while (true) {
+		{
+			std::unique_lock< std::mutex > lock(mutex);
+			start_cv.wait(lock, [&](){ return quit || generation != seen; });
+			if (quit) return;
+			seen = generation;
+		}
+
+		work(worker);
+
+		{
+			std::unique_lock< std::mutex > lock(mutex);
+			active -= 1;
+			if (active == 0) done_cv.notify_one();
+		}
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+/*
+ * Jobs is a small pool of worker threads used to split loops across cores.
+ *
+ * parallel_for(count, grain, job) calls job(begin, end, worker) on ranges of
+ * at most 'grain' items that together cover [0,count), using the pool's
+ * threads and the calling thread, and returns once every range is done.
+ * 'worker' is in [0,workers()) and no two jobs running at the same time share
+ * it, so it can index per-thread scratch storage (e.g., output buffers that
+ * the caller merges afterward).
+ *
+ * Jobs run on other threads, so they must not call OpenGL (the context
+ * belongs to the main thread), must not throw, and must not call
+ * parallel_for themselves.
+ *
+ * Jobs::shared() is a pool with one thread per extra hardware thread,
+ * started on first use.
+ *
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct Jobs {
+	//start 'thread_count' worker threads (which help the thread that calls parallel_for):
+	explicit Jobs(uint32_t thread_count);
+	~Jobs();
+
+	//(owns threads, so copying is not allowed)
+	Jobs(Jobs const &) = delete;
+	Jobs &operator=(Jobs const &) = delete;
+
+	//number of threads that can run jobs at once (pool threads + the calling thread):
+	uint32_t workers() const { return uint32_t(threads.size()) + 1; }
+
+	//run job(begin, end, worker) on ranges of at most 'grain' items covering [0,count):
+	// (if count <= grain, this just calls job(0, count, 0) on the calling thread)
+	using Job = std::function< void(uint32_t begin, uint32_t end, uint32_t worker) >;
+	void parallel_for(uint32_t count, uint32_t grain, Job const &job);
+
+	//pool shared by the whole program:
+	static Jobs &shared();
+
+	//-- internals --
+	std::vector< std::thread > threads;
+
+	std::mutex call_mutex; //held for the duration of each parallel_for, so calls from different threads take turns
+
+	std::mutex mutex; //guards the members below (except the atomics)
+	std::condition_variable start_cv; //signalled when a new parallel_for starts (or on quit)
+	std::condition_variable done_cv; //signalled when the last pool thread finishes its part of a parallel_for
+	bool quit = false;
+	uint32_t generation = 0; //incremented by each parallel_for
+	uint32_t active = 0; //pool threads that haven't finished the current parallel_for
+
+	//current parallel_for:
+	Job const *job = nullptr;
+	uint32_t count = 0;
+	uint32_t grain = 1;
+	std::atomic< uint32_t > next{0}; //first item not yet handed out
+
+	//hand out ranges of the current parallel_for until there are none left:
+	void work(uint32_t worker);
+	//loop run by pool threads:
+	void thread_main(uint32_t worker);
+};
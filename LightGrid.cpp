@@ -0,0 +1,203 @@
+#include "LightGrid.hpp"
+
+#include "gl_errors.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+LightGrid::~LightGrid() {
+	glDeleteBuffers(1, &cluster_buffer);
+	glDeleteBuffers(1, &light_data_buffer);
+	glDeleteBuffers(1, &cluster_ranges_buffer);
+	glDeleteBuffers(1, &cluster_lights_buffer);
+	glDeleteTextures(1, &light_data_tex);
+	glDeleteTextures(1, &cluster_ranges_tex);
+	glDeleteTextures(1, &cluster_lights_tex);
+}
+
+void LightGrid::update(Scene const &scene, Scene::Camera const &camera, glm::uvec2 const &drawable_size) {
+	assert(camera.transform);
+	assert(size.x > 0 && size.y > 0 && size.z > 0);
+
+	stats = Stats();
+
+	glm::mat4x3 world_to_view = camera.transform->make_world_to_local();
+
+	//for a point at depth d (== -z in view space), ndc.x = x / (d * tan_x) and ndc.y = y / (d * tan_y):
+	float tan_y = std::tan(0.5f * camera.fovy);
+	float tan_x = tan_y * camera.aspect;
+
+	//depth slice of a given (positive) depth:
+	float log_near = std::log(camera.near);
+	float slice_scale = float(size.z) / (std::log(std::max(far, camera.near * 1.01f)) - log_near);
+	auto slice = [&](float depth) -> uint32_t {
+		if (depth <= camera.near) return 0;
+		float s = (std::log(depth) - log_near) * slice_scale;
+		return uint32_t(std::min(s, float(size.z - 1)));
+	};
+
+	//tile of a given ndc coordinate (clamped to the grid):
+	auto tile = [](float ndc, uint32_t tiles) -> uint32_t {
+		float t = (0.5f * ndc + 0.5f) * float(tiles);
+		return uint32_t(std::max(0.0f, std::min(t, float(tiles - 1))));
+	};
+
+	cluster_block.CLUSTER_COUNT = glm::ivec4(int(size.x), int(size.y), int(size.z), 0);
+	cluster_block.CLUSTER_SCALE = glm::vec4(
+		float(size.x) / float(std::max(drawable_size.x, 1U)),
+		float(size.y) / float(std::max(drawable_size.y, 1U)),
+		slice_scale,
+		-log_near * slice_scale
+	);
+
+	//----- first pass: pack lights and find the clusters each one overlaps -----
+	light_data.clear();
+	light_bounds.clear();
+	light_data.reserve(scene.lights.size());
+	light_bounds.reserve(scene.lights.size());
+
+	cluster_ranges.assign(size.x * size.y * size.z, glm::uvec2(0));
+
+	for (auto const &light : scene.lights) {
+		glm::mat4x3 const &light_to_world = light.transform->cached_local_to_world();
+		glm::vec3 position = light_to_world[3];
+		glm::vec3 direction = glm::normalize(-glm::vec3(light_to_world[2])); //lights shine along their -z axis
+
+		LightBounds bounds;
+		bounds.min = glm::uvec3(0);
+		bounds.max = size - glm::uvec3(1);
+
+		bool limited = (light.type == Scene::Light::Point || light.type == Scene::Light::Spot) && light.distance > 0.0f;
+		if (limited) {
+			float r = light.distance;
+			glm::vec3 center = world_to_view * glm::vec4(position, 1.0f);
+			float d0 = -center.z - r;
+			float d1 = -center.z + r;
+			if (d1 <= camera.near) continue; //entirely behind the camera
+
+			bounds.min.z = slice(d0);
+			bounds.max.z = slice(d1);
+
+			//(if the light's sphere crosses the near plane, it may cover any tile)
+			if (d0 > camera.near) {
+				//the sphere's view-space box projects inside the extremes of its corners at the nearest and farthest depths:
+				glm::vec2 lo = glm::vec2(center) - glm::vec2(r);
+				glm::vec2 hi = glm::vec2(center) + glm::vec2(r);
+				glm::vec2 ndc_lo = glm::min(lo / d0, lo / d1) / glm::vec2(tan_x, tan_y);
+				glm::vec2 ndc_hi = glm::max(hi / d0, hi / d1) / glm::vec2(tan_x, tan_y);
+				if (ndc_hi.x < -1.0f || ndc_lo.x > 1.0f || ndc_hi.y < -1.0f || ndc_lo.y > 1.0f) continue; //off screen
+
+				bounds.min.x = tile(ndc_lo.x, size.x);
+				bounds.max.x = tile(ndc_hi.x, size.x);
+				bounds.min.y = tile(ndc_lo.y, size.y);
+				bounds.max.y = tile(ndc_hi.y, size.y);
+			}
+		}
+
+		light_data.emplace_back();
+		Scene::LightsBlock::Entry &entry = light_data.back();
+		float type = 0.0f;
+		if (light.type == Scene::Light::Point) type = 0.0f;
+		else if (light.type == Scene::Light::Hemisphere) type = 1.0f;
+		else if (light.type == Scene::Light::Spot) type = 2.0f;
+		else if (light.type == Scene::Light::Directional) type = 3.0f;
+		entry.POSITION = glm::vec4(position, type);
+		entry.DIRECTION = glm::vec4(direction, std::cos(0.5f * light.spot_fov));
+		entry.ENERGY = glm::vec4(light.energy, limited ? light.distance : 0.0f);
+
+		light_bounds.emplace_back(bounds);
+
+		//count the light in each cluster it overlaps:
+		for (uint32_t z = bounds.min.z; z <= bounds.max.z; ++z) {
+			for (uint32_t y = bounds.min.y; y <= bounds.max.y; ++y) {
+				for (uint32_t x = bounds.min.x; x <= bounds.max.x; ++x) {
+					cluster_ranges[(z * size.y + y) * size.x + x].y += 1;
+				}
+			}
+		}
+	}
+	stats.lights = uint32_t(scene.lights.size());
+	stats.visible_lights = uint32_t(light_data.size());
+
+	//----- second pass: lay out each cluster's list, then fill in the lists -----
+	uint32_t total = 0;
+	for (auto &range : cluster_ranges) {
+		range.x = total;
+		total += range.y;
+		stats.max_cluster_lights = std::max(stats.max_cluster_lights, range.y);
+		range.y = 0; //(counted again while filling)
+	}
+	stats.cluster_lights = total;
+
+	cluster_lights.resize(std::max(total, 1U)); //(zero-sized buffers aren't allowed)
+	for (uint32_t l = 0; l < light_bounds.size(); ++l) {
+		LightBounds const &bounds = light_bounds[l];
+		for (uint32_t z = bounds.min.z; z <= bounds.max.z; ++z) {
+			for (uint32_t y = bounds.min.y; y <= bounds.max.y; ++y) {
+				for (uint32_t x = bounds.min.x; x <= bounds.max.x; ++x) {
+					glm::uvec2 &range = cluster_ranges[(z * size.y + y) * size.x + x];
+					cluster_lights[range.x + range.y] = l;
+					range.y += 1;
+				}
+			}
+		}
+	}
+
+	//----- upload -----
+	if (cluster_buffer == 0) {
+		glGenBuffers(1, &cluster_buffer);
+		glGenBuffers(1, &light_data_buffer);
+		glGenBuffers(1, &cluster_ranges_buffer);
+		glGenBuffers(1, &cluster_lights_buffer);
+		glGenTextures(1, &light_data_tex);
+		glGenTextures(1, &cluster_ranges_tex);
+		glGenTextures(1, &cluster_lights_tex);
+	}
+
+	glBindBuffer(GL_UNIFORM_BUFFER, cluster_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(ClusterBlock), &cluster_block, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	//(re-specifying each buffer lets the driver hand back fresh storage instead of waiting on last frame's draws)
+	if (light_data.empty()) light_data.emplace_back(); //(zero-sized buffers aren't allowed; nothing refers to this entry)
+	glBindBuffer(GL_TEXTURE_BUFFER, light_data_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, light_data.size() * sizeof(Scene::LightsBlock::Entry), light_data.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, cluster_ranges_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, cluster_ranges.size() * sizeof(glm::uvec2), cluster_ranges.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, cluster_lights_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, cluster_lights.size() * sizeof(uint32_t), cluster_lights.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	//attach buffers to textures:
+	glBindTexture(GL_TEXTURE_BUFFER, light_data_tex);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, light_data_buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, cluster_ranges_tex);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, cluster_ranges_buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, cluster_lights_tex);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, cluster_lights_buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+	GL_ERRORS();
+}
+
+void LightGrid::bind() const {
+	glBindBufferBase(GL_UNIFORM_BUFFER, ClusterBlockBinding, cluster_buffer);
+
+	glActiveTexture(GL_TEXTURE0 + LightDataUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, light_data_tex);
+	glActiveTexture(GL_TEXTURE0 + ClusterRangesUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, cluster_ranges_tex);
+	glActiveTexture(GL_TEXTURE0 + ClusterLightsUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, cluster_lights_tex);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void LightGrid::unbind() const {
+	glActiveTexture(GL_TEXTURE0 + LightDataUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0 + ClusterRangesUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0 + ClusterLightsUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0);
+}
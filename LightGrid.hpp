@@ -0,0 +1,91 @@
+#pragma once
+
+/*
+ * A LightGrid assigns a Scene's lights to "clusters" -- screen tiles split
+ * into slices by depth (froxels) -- so that each fragment only evaluates
+ * the lights whose range overlaps its cluster.
+ *
+ * The grid is built on the CPU every frame (from the camera and the lights'
+ * positions and ranges) and uploaded as texture buffers, which the
+ * LitColorTextureProgram::Clustered variant reads.
+ *
+ * Usage:
+ *   light_grid.update(scene, *camera, drawable_size);
+ *   light_grid.bind();
+ *   scene.draw(*camera); //with drawables using lit_color_texture_clustered_program_pipeline
+ *
+ */
+
+#include "GL.hpp"
+#include "Scene.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+struct LightGrid {
+	LightGrid() = default;
+	~LightGrid();
+
+	//(owns OpenGL objects, so copying is not allowed)
+	LightGrid(LightGrid const &) = delete;
+	LightGrid &operator=(LightGrid const &) = delete;
+
+	//grid dimensions (tiles across, tiles down, depth slices):
+	glm::uvec3 size = glm::uvec3(16, 9, 24);
+	//depth slices are spaced exponentially from the camera's near plane to this distance (the last slice continues forever):
+	float far = 100.0f;
+
+	//assign lights to clusters for a view from 'camera' of a 'drawable_size' framebuffer, and upload the results:
+	// (positions are stored in world space, so draw with Scene::draw(Camera const &), which uses world space for lighting)
+	void update(Scene const &scene, Scene::Camera const &camera, glm::uvec2 const &drawable_size);
+
+	//bind the grid's uniform block and textures where the clustered program expects them:
+	// (leaves GL_TEXTURE0 active, as Scene::draw expects)
+	void bind() const;
+	//un-bind the textures bound by bind():
+	void unbind() const;
+
+	//texture units and uniform block binding used by bind():
+	// (units start after the ones that Scene::draw manages for drawables)
+	enum : GLuint {
+		LightDataUnit = Scene::Drawable::Pipeline::TextureCount, //RGBA32F -- three texels (a Scene::LightsBlock::Entry) per light
+		ClusterRangesUnit, //RG32UI -- per cluster, (first, count) in cluster lights
+		ClusterLightsUnit, //R32UI -- light indices, grouped by cluster
+	};
+	enum : GLuint { ClusterBlockBinding = Scene::LightsBlockBinding + 1 };
+
+	//Layout (std140) of the uniform block that tells shaders how to find their cluster:
+	// GLSL: layout(std140) uniform Clusters { ivec4 CLUSTER_COUNT; vec4 CLUSTER_SCALE; };
+	// cluster = floor(vec3(gl_FragCoord.xy * CLUSTER_SCALE.xy, log(view_depth) * CLUSTER_SCALE.z + CLUSTER_SCALE.w))
+	struct ClusterBlock {
+		glm::ivec4 CLUSTER_COUNT; //xyz: size
+		glm::vec4 CLUSTER_SCALE; //xy: tiles per pixel, z: slices per unit of log(depth), w: -log(near) * z
+	};
+	static_assert(sizeof(ClusterBlock) == 16 + 16, "ClusterBlock matches std140 layout.");
+
+	//Counts from the most recent call to update():
+	struct Stats {
+		uint32_t lights = 0; //lights in the grid
+		uint32_t visible_lights = 0; //lights that overlap at least one cluster
+		uint32_t cluster_lights = 0; //total light indices over all clusters
+		uint32_t max_cluster_lights = 0; //most lights in any one cluster
+	} stats;
+
+	//-- internals --
+	ClusterBlock cluster_block;
+	std::vector< Scene::LightsBlock::Entry > light_data;
+	std::vector< glm::uvec2 > cluster_ranges;
+	std::vector< uint32_t > cluster_lights;
+
+	//per-light cluster bounds, computed in the first pass of update():
+	struct LightBounds {
+		glm::uvec3 min, max; //inclusive
+	};
+	std::vector< LightBounds > light_bounds;
+
+	GLuint cluster_buffer = 0; //uniform buffer holding cluster_block
+	GLuint light_data_buffer = 0, light_data_tex = 0;
+	GLuint cluster_ranges_buffer = 0, cluster_ranges_tex = 0;
+	GLuint cluster_lights_buffer = 0, cluster_lights_tex = 0;
+};
@@ -1,9 +1,11 @@
 #include "LitColorTextureProgram.hpp"
 
+#include "LightGrid.hpp"
 #include "gl_compile_program.hpp"
 #include "gl_errors.hpp"
 
 Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
+Scene::Drawable::Pipeline lit_color_texture_clustered_program_pipeline;
 
 Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> LitColorTextureProgram const * {
 	LitColorTextureProgram *ret = new LitColorTextureProgram();
@@ -14,14 +16,8 @@ Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> L
 	lit_color_texture_program_pipeline.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
 	lit_color_texture_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
 	lit_color_texture_program_pipeline.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
-
-	/* This will be used later if/when we build a light loop into the Scene:
-	lit_color_texture_program_pipeline.LIGHT_TYPE_int = ret->LIGHT_TYPE_int;
-	lit_color_texture_program_pipeline.LIGHT_LOCATION_vec3 = ret->LIGHT_LOCATION_vec3;
-	lit_color_texture_program_pipeline.LIGHT_DIRECTION_vec3 = ret->LIGHT_DIRECTION_vec3;
-	lit_color_texture_program_pipeline.LIGHT_ENERGY_vec3 = ret->LIGHT_ENERGY_vec3;
-	lit_color_texture_program_pipeline.LIGHT_CUTOFF_float = ret->LIGHT_CUTOFF_float;
-	*/
+	lit_color_texture_program_pipeline.OBJECT_block = ret->OBJECT_block;
+	//(lights are read from the Lights block, which Scene::draw fills in)
 
 	//make a 1-pixel white texture to bind by default:
 	GLuint tex;
@@ -43,65 +39,207 @@ Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> L
 	return ret;
 });
 
-LitColorTextureProgram::LitColorTextureProgram() {
+Load< LitColorTextureProgram > lit_color_texture_instanced_program(LoadTagEarly, []() -> LitColorTextureProgram const * {
+	LitColorTextureProgram *ret = new LitColorTextureProgram(LitColorTextureProgram::Instanced);
+
+	//----- add instanced drawing to the pipeline template -----
+	lit_color_texture_program_pipeline.instanced.program = ret->program;
+
+	lit_color_texture_program_pipeline.instanced.WORLD_TO_CLIP_mat4 = ret->WORLD_TO_CLIP_mat4;
+	lit_color_texture_program_pipeline.instanced.WORLD_TO_LIGHT_mat4x3 = ret->WORLD_TO_LIGHT_mat4x3;
+	lit_color_texture_program_pipeline.instanced.NORMAL_WORLD_TO_LIGHT_mat3 = ret->NORMAL_WORLD_TO_LIGHT_mat3;
+
+	return ret;
+});
+
+Load< LitColorTextureProgram > lit_color_texture_clustered_program(LoadTagEarly, []() -> LitColorTextureProgram const * {
+	LitColorTextureProgram *ret = new LitColorTextureProgram(LitColorTextureProgram::Clustered);
+
+	//----- build the pipeline template (same as the basic one, but with a different program) -----
+	//NOTE: relies on lit_color_texture_program being loaded first (for the default texture), which it is, since it is declared first.
+	lit_color_texture_clustered_program_pipeline = lit_color_texture_program_pipeline;
+	lit_color_texture_clustered_program_pipeline.instanced = Scene::Drawable::Pipeline::Instanced();
+	lit_color_texture_clustered_program_pipeline.multi_draw = Scene::Drawable::Pipeline::MultiDraw();
+
+	lit_color_texture_clustered_program_pipeline.program = ret->program;
+
+	lit_color_texture_clustered_program_pipeline.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
+	lit_color_texture_clustered_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
+	lit_color_texture_clustered_program_pipeline.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
+	lit_color_texture_clustered_program_pipeline.OBJECT_block = ret->OBJECT_block;
+
+	return ret;
+});
+
+Load< LitColorTextureProgram > lit_color_texture_multi_draw_program(LoadTagEarly, []() -> LitColorTextureProgram const * {
+	LitColorTextureProgram *ret = new LitColorTextureProgram(LitColorTextureProgram::MultiDraw);
+
+	//----- add multi-draw batching to the pipeline template -----
+	lit_color_texture_program_pipeline.multi_draw.program = ret->program;
+
+	lit_color_texture_program_pipeline.multi_draw.DRAW_BASE_int = ret->DRAW_BASE_int;
+	lit_color_texture_program_pipeline.multi_draw.WORLD_TO_CLIP_mat4 = ret->WORLD_TO_CLIP_mat4;
+	lit_color_texture_program_pipeline.multi_draw.WORLD_TO_LIGHT_mat4x3 = ret->WORLD_TO_LIGHT_mat4x3;
+	lit_color_texture_program_pipeline.multi_draw.NORMAL_WORLD_TO_LIGHT_mat3 = ret->NORMAL_WORLD_TO_LIGHT_mat3;
+
+	return ret;
+});
+
+//the instance (and draw id) attribute locations are written directly into the shader below:
+static_assert(Scene::Drawable::InstanceObjectToWorldLocation == 4, "instance attribute locations match shader");
+static_assert(Scene::Drawable::InstanceNormalToWorldLocation == 8, "instance attribute locations match shader");
+static_assert(Scene::Drawable::DrawIDLocation == 11, "draw id attribute location matches shader");
+//the multi-draw matrices texture can't share a unit with the light grid:
+static_assert(GLuint(Scene::Drawable::MultiDrawMatricesUnit) > GLuint(LightGrid::ClusterLightsUnit), "multi-draw matrices have their own texture unit");
+
+LitColorTextureProgram::LitColorTextureProgram(Variant variant_) : variant(variant_) {
+	//Variants share shader code, selected by preprocessor definitions:
+	std::string defines = "#version 330\n";
+	if (variant == Instanced) defines += "#define INSTANCED\n";
+	if (variant == MultiDraw) defines += "#define INSTANCED\n#define MULTI_DRAW\n"; //(multi-draw is instancing with matrices from elsewhere)
+	if (variant == Clustered) defines += "#define CLUSTERED\n";
+	defines += "#define MAX_LIGHTS " + std::to_string(Scene::MaxLights) + "\n";
+	defines += "#define MAX_OBJECT_LIGHTS " + std::to_string(Scene::MaxObjectLights) + "\n";
+
+	//the per-object block is read by both shaders (matrices in the vertex shader, light list in the fragment shader):
+	std::string object_block =
+		"#ifndef INSTANCED\n"
+		"layout(std140) uniform Object {\n" //see Scene::ObjectBlock
+		"	mat4 OBJECT_TO_CLIP;\n"
+		"	mat4x3 OBJECT_TO_LIGHT;\n"
+		"	mat3 NORMAL_TO_LIGHT;\n"
+		"	ivec4 LIGHT_INDICES[MAX_OBJECT_LIGHTS / 4];\n"
+		"};\n"
+		"#endif\n"
+	;
+
 	//Compile vertex and fragment shaders using the convenient 'gl_compile_program' helper function:
 	program = gl_compile_program(
 		//vertex shader:
-		"#version 330\n"
-		"uniform mat4 OBJECT_TO_CLIP;\n"
-		"uniform mat4x3 OBJECT_TO_LIGHT;\n"
-		"uniform mat3 NORMAL_TO_LIGHT;\n"
-		"in vec4 Position;\n"
-		"in vec3 Normal;\n"
-		"in vec4 Color;\n"
-		"in vec2 TexCoord;\n"
+		defines + object_block +
+		"#ifdef INSTANCED\n"
+		"uniform mat4 WORLD_TO_CLIP;\n"
+		"uniform mat4x3 WORLD_TO_LIGHT;\n"
+		"uniform mat3 NORMAL_WORLD_TO_LIGHT;\n"
+		"#ifdef MULTI_DRAW\n"
+		"uniform int DRAW_BASE;\n"
+		"uniform samplerBuffer DRAW_MATRICES;\n" //six texels per drawable (see Scene::Drawable::Pipeline::MultiDraw)
+		"layout(location = 11) in uint DRAW_ID;\n"
+		"#else\n"
+		"layout(location = 4) in mat4x3 OBJECT_TO_WORLD;\n"
+		"layout(location = 8) in mat3 NORMAL_TO_WORLD;\n"
+		"#endif\n"
+		"#endif\n"
+		"layout(location = 0) in vec4 Position;\n" //(explicit, so mesh attributes never land on the locations above)
+		"layout(location = 1) in vec3 Normal;\n"
+		"layout(location = 2) in vec4 Color;\n"
+		"layout(location = 3) in vec2 TexCoord;\n"
 		"out vec3 position;\n"
 		"out vec3 normal;\n"
 		"out vec4 color;\n"
 		"out vec2 texCoord;\n"
+		"#ifdef CLUSTERED\n"
+		"out float viewDepth;\n" //(used to find the fragment's depth slice)
+		"#endif\n"
 		"void main() {\n"
+		"#ifdef MULTI_DRAW\n"
+		"	int d = 6 * (DRAW_BASE + int(DRAW_ID));\n"
+		"	mat4x3 OBJECT_TO_WORLD = transpose(mat3x4(texelFetch(DRAW_MATRICES, d+0), texelFetch(DRAW_MATRICES, d+1), texelFetch(DRAW_MATRICES, d+2)));\n"
+		"	mat3 NORMAL_TO_WORLD = mat3(texelFetch(DRAW_MATRICES, d+3).xyz, texelFetch(DRAW_MATRICES, d+4).xyz, texelFetch(DRAW_MATRICES, d+5).xyz);\n"
+		"#endif\n"
+		"#ifdef INSTANCED\n"
+		"	vec4 world_position = vec4(OBJECT_TO_WORLD * Position, 1.0);\n"
+		"	gl_Position = WORLD_TO_CLIP * world_position;\n"
+		"	position = WORLD_TO_LIGHT * world_position;\n"
+		"	normal = NORMAL_WORLD_TO_LIGHT * (NORMAL_TO_WORLD * Normal);\n"
+		"#else\n"
 		"	gl_Position = OBJECT_TO_CLIP * Position;\n"
 		"	position = OBJECT_TO_LIGHT * Position;\n"
 		"	normal = NORMAL_TO_LIGHT * Normal;\n"
+		"#endif\n"
 		"	color = Color;\n"
 		"	texCoord = TexCoord;\n"
+		"#ifdef CLUSTERED\n"
+		"	viewDepth = gl_Position.w;\n"
+		"#endif\n"
 		"}\n"
 	,
 		//fragment shader:
-		"#version 330\n"
+		defines + object_block +
 		"uniform sampler2D TEX;\n"
-		"uniform int LIGHT_TYPE;\n"
-		"uniform vec3 LIGHT_LOCATION;\n"
-		"uniform vec3 LIGHT_DIRECTION;\n"
-		"uniform vec3 LIGHT_ENERGY;\n"
-		"uniform float LIGHT_CUTOFF;\n"
+		"struct Light {\n" //see Scene::LightsBlock
+		"	vec4 POSITION;\n" //xyz: position, w: type
+		"	vec4 DIRECTION;\n" //xyz: direction, w: spot cutoff
+		"	vec4 ENERGY;\n" //rgb: energy, a: range
+		"};\n"
+		"#ifdef CLUSTERED\n"
+		"layout(std140) uniform Clusters {\n" //see LightGrid::ClusterBlock
+		"	ivec4 CLUSTER_COUNT;\n"
+		"	vec4 CLUSTER_SCALE;\n"
+		"};\n"
+		"uniform samplerBuffer LIGHT_DATA;\n" //three texels per light
+		"uniform usamplerBuffer CLUSTER_RANGES;\n" //(first, count) per cluster
+		"uniform usamplerBuffer CLUSTER_LIGHTS;\n" //light indices
+		"in float viewDepth;\n"
+		"#else\n"
+		"layout(std140) uniform Lights {\n"
+		"	ivec4 LIGHT_COUNT;\n"
+		"	Light LIGHTS[MAX_LIGHTS];\n"
+		"};\n"
+		"#endif\n"
 		"in vec3 position;\n"
 		"in vec3 normal;\n"
 		"in vec4 color;\n"
 		"in vec2 texCoord;\n"
 		"out vec4 fragColor;\n"
-		"void main() {\n"
-		"	vec3 n = normalize(normal);\n"
-		"	vec3 e;\n"
-		"	if (LIGHT_TYPE == 0) { //point light \n"
-		"		vec3 l = (LIGHT_LOCATION - position);\n"
+		"vec3 light_energy(Light light, vec3 n) {\n"
+		"	int type = int(light.POSITION.w);\n"
+		"	if (type == 0 || type == 2) { //point or spot light \n"
+		"		vec3 l = (light.POSITION.xyz - position);\n"
 		"		float dis2 = dot(l,l);\n"
 		"		l = normalize(l);\n"
 		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-		"		e = nl * LIGHT_ENERGY;\n"
-		"	} else if (LIGHT_TYPE == 1) { //hemi light \n"
-		"		e = (dot(n,-LIGHT_DIRECTION) * 0.5 + 0.5) * LIGHT_ENERGY;\n"
-		"	} else if (LIGHT_TYPE == 2) { //spot light \n"
-		"		vec3 l = (LIGHT_LOCATION - position);\n"
-		"		float dis2 = dot(l,l);\n"
-		"		l = normalize(l);\n"
-		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-		"		float c = dot(l,-LIGHT_DIRECTION);\n"
-		"		nl *= smoothstep(LIGHT_CUTOFF,mix(LIGHT_CUTOFF,1.0,0.1), c);\n"
-		"		e = nl * LIGHT_ENERGY;\n"
-		"	} else { //(LIGHT_TYPE == 3) //directional light \n"
-		"		e = max(0.0, dot(n,-LIGHT_DIRECTION)) * LIGHT_ENERGY;\n"
+		"		if (type == 2) {\n"
+		"			float c = dot(l,-light.DIRECTION.xyz);\n"
+		"			nl *= smoothstep(light.DIRECTION.w,mix(light.DIRECTION.w,1.0,0.1), c);\n"
+		"		}\n"
+		"		if (light.ENERGY.a > 0.0) { //fade out before range \n"
+		"			float f = clamp(1.0 - dis2 / (light.ENERGY.a * light.ENERGY.a), 0.0, 1.0);\n"
+		"			nl *= f * f;\n"
+		"		}\n"
+		"		return nl * light.ENERGY.rgb;\n"
+		"	} else if (type == 1) { //hemi light \n"
+		"		return (dot(n,-light.DIRECTION.xyz) * 0.5 + 0.5) * light.ENERGY.rgb;\n"
+		"	} else { //(type == 3) //directional light \n"
+		"		return max(0.0, dot(n,-light.DIRECTION.xyz)) * light.ENERGY.rgb;\n"
 		"	}\n"
+		"}\n"
+		"void main() {\n"
+		"	vec3 n = normalize(normal);\n"
+		"	vec3 e = vec3(0.0);\n"
+		"#if defined(CLUSTERED)\n"
+		"	ivec3 cluster = ivec3(floor(vec3(gl_FragCoord.xy * CLUSTER_SCALE.xy, log(viewDepth) * CLUSTER_SCALE.z + CLUSTER_SCALE.w)));\n"
+		"	cluster = clamp(cluster, ivec3(0), CLUSTER_COUNT.xyz - 1);\n"
+		"	uvec2 range = texelFetch(CLUSTER_RANGES, (cluster.z * CLUSTER_COUNT.y + cluster.y) * CLUSTER_COUNT.x + cluster.x).xy;\n"
+		"	for (uint i = 0u; i < range.y; ++i) {\n" //fragments are lit by the lights that reach their cluster
+		"		int l = int(texelFetch(CLUSTER_LIGHTS, int(range.x + i)).x);\n"
+		"		Light light;\n"
+		"		light.POSITION = texelFetch(LIGHT_DATA, 3 * l + 0);\n"
+		"		light.DIRECTION = texelFetch(LIGHT_DATA, 3 * l + 1);\n"
+		"		light.ENERGY = texelFetch(LIGHT_DATA, 3 * l + 2);\n"
+		"		e += light_energy(light, n);\n"
+		"	}\n"
+		"#elif defined(INSTANCED)\n"
+		"	for (int i = 0; i < LIGHT_COUNT.x; ++i) {\n" //instances are lit by every light
+		"		e += light_energy(LIGHTS[i], n);\n"
+		"	}\n"
+		"#else\n"
+		"	for (int i = 0; i < MAX_OBJECT_LIGHTS; ++i) {\n" //objects are lit by the lights that reach them
+		"		int l = LIGHT_INDICES[i / 4][i % 4];\n"
+		"		if (l < 0) break;\n"
+		"		e += light_energy(LIGHTS[l], n);\n"
+		"	}\n"
+		"#endif\n"
 		"	vec4 albedo = texture(TEX, texCoord) * color;\n"
 		"	fragColor = vec4(e*albedo.rgb, albedo.a);\n"
 		"}\n"
@@ -120,11 +258,27 @@ LitColorTextureProgram::LitColorTextureProgram() {
 	OBJECT_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "OBJECT_TO_LIGHT");
 	NORMAL_TO_LIGHT_mat3 = glGetUniformLocation(program, "NORMAL_TO_LIGHT");
 
-	LIGHT_TYPE_int = glGetUniformLocation(program, "LIGHT_TYPE");
-	LIGHT_LOCATION_vec3 = glGetUniformLocation(program, "LIGHT_LOCATION");
-	LIGHT_DIRECTION_vec3 = glGetUniformLocation(program, "LIGHT_DIRECTION");
-	LIGHT_ENERGY_vec3 = glGetUniformLocation(program, "LIGHT_ENERGY");
-	LIGHT_CUTOFF_float = glGetUniformLocation(program, "LIGHT_CUTOFF");
+	//per-object matrices are in a uniform block, which Scene::draw expects at a fixed binding point:
+	OBJECT_block = glGetUniformBlockIndex(program, "Object");
+	if (OBJECT_block != GL_INVALID_INDEX) {
+		glUniformBlockBinding(program, OBJECT_block, Scene::ObjectBlockBinding);
+	}
+
+	WORLD_TO_CLIP_mat4 = glGetUniformLocation(program, "WORLD_TO_CLIP");
+	WORLD_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "WORLD_TO_LIGHT");
+	NORMAL_WORLD_TO_LIGHT_mat3 = glGetUniformLocation(program, "NORMAL_WORLD_TO_LIGHT");
+	DRAW_BASE_int = glGetUniformLocation(program, "DRAW_BASE");
+
+	//lights are also in a uniform block at a fixed binding point:
+	LIGHTS_block = glGetUniformBlockIndex(program, "Lights");
+	if (LIGHTS_block != GL_INVALID_INDEX) {
+		glUniformBlockBinding(program, LIGHTS_block, Scene::LightsBlockBinding);
+	}
+	//...or, for the clustered variant, in a light grid:
+	CLUSTERS_block = glGetUniformBlockIndex(program, "Clusters");
+	if (CLUSTERS_block != GL_INVALID_INDEX) {
+		glUniformBlockBinding(program, CLUSTERS_block, LightGrid::ClusterBlockBinding);
+	}
 
 
 	GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
@@ -134,10 +288,23 @@ LitColorTextureProgram::LitColorTextureProgram() {
 
 	glUniform1i(TEX_sampler2D, 0); //set TEX to sample from GL_TEXTURE0
 
+	if (variant == Clustered) {
+		//light grid textures are bound by LightGrid::bind():
+		glUniform1i(glGetUniformLocation(program, "LIGHT_DATA"), LightGrid::LightDataUnit);
+		glUniform1i(glGetUniformLocation(program, "CLUSTER_RANGES"), LightGrid::ClusterRangesUnit);
+		glUniform1i(glGetUniformLocation(program, "CLUSTER_LIGHTS"), LightGrid::ClusterLightsUnit);
+	}
+
+	if (variant == MultiDraw) {
+		//per-drawable matrices are bound by Scene::draw():
+		glUniform1i(glGetUniformLocation(program, "DRAW_MATRICES"), Scene::Drawable::MultiDrawMatricesUnit);
+	}
+
 	glUseProgram(0); //unbind program -- glUniform* calls refer to ??? now
 }
 
 LitColorTextureProgram::~LitColorTextureProgram() {
+	MeshArena::forget_program(program); //(vertex arrays were made for it by MeshBuffer::make_vao_for_program)
 	glDeleteProgram(program);
 	program = 0;
 }
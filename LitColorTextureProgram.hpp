@@ -6,9 +6,18 @@
 
 //Shader program that draws transformed, lit, textured vertices tinted with vertex colors:
 struct LitColorTextureProgram {
-	LitColorTextureProgram();
+	//variants of the program:
+	enum Variant {
+		Basic, //per-object matrices read from a uniform block (see Scene::ObjectBlock)
+		Instanced, //per-object matrices read from instance attributes (see Scene::Drawable::Pipeline::Instanced)
+		Clustered, //like Basic, but lights are read from a LightGrid (for scenes with many lights)
+		MultiDraw, //like Instanced, but per-object matrices are read from a buffer texture by draw id (see Scene::Drawable::Pipeline::MultiDraw)
+	};
+	LitColorTextureProgram(Variant variant = Basic);
 	~LitColorTextureProgram();
 
+	Variant variant = Basic;
+
 	GLuint program = 0;
 
 	//Attribute (per-vertex variable) locations:
@@ -22,19 +31,43 @@ struct LitColorTextureProgram {
 	GLuint OBJECT_TO_LIGHT_mat4x3 = -1U;
 	GLuint NORMAL_TO_LIGHT_mat3 = -1U;
 
-	//lighting:
-	GLuint LIGHT_TYPE_int = -1U;
-	GLuint LIGHT_LOCATION_vec3 = -1U;
-	GLuint LIGHT_DIRECTION_vec3 = -1U;
-	GLuint LIGHT_ENERGY_vec3 = -1U;
-	GLuint LIGHT_CUTOFF_float = -1U;
+	//(Basic and Clustered variants only) the above matrices are actually read from this uniform block (laid out as Scene::ObjectBlock):
+	GLuint OBJECT_block = -1U;
+
+	//(Instanced and MultiDraw variants only) uniforms shared by all instances:
+	GLuint WORLD_TO_CLIP_mat4 = -1U;
+	GLuint WORLD_TO_LIGHT_mat4x3 = -1U;
+	GLuint NORMAL_WORLD_TO_LIGHT_mat3 = -1U;
+
+	//(MultiDraw variant only) index of the batch's first drawable in the matrices texture:
+	GLuint DRAW_BASE_int = -1U;
+
+	//lighting comes from this uniform block (laid out as Scene::LightsBlock, filled in by Scene::draw):
+	// (Basic variant evaluates the lights listed in the object block; Instanced and MultiDraw variants evaluate all of them)
+	GLuint LIGHTS_block = -1U;
+
+	//(Clustered variant only) lighting comes from a LightGrid instead:
+	GLuint CLUSTERS_block = -1U; //bound to LightGrid::ClusterBlockBinding
 	
 	//Textures:
 	//TEXTURE0 - texture that is accessed by TexCoord
+	//(Clustered variant only) LightGrid::LightDataUnit, ClusterRangesUnit, ClusterLightsUnit - set by LightGrid::bind()
+	//(MultiDraw variant only) Scene::Drawable::MultiDrawMatricesUnit - set by Scene::draw()
 };
 
 extern Load< LitColorTextureProgram > lit_color_texture_program;
+extern Load< LitColorTextureProgram > lit_color_texture_instanced_program;
+extern Load< LitColorTextureProgram > lit_color_texture_clustered_program;
+extern Load< LitColorTextureProgram > lit_color_texture_multi_draw_program;
 
 //For convenient scene-graph setup, copy this object:
 // NOTE: by default, has texture bound to 1-pixel white texture -- so it's okay to use with vertex-color-only meshes.
+// NOTE: pipeline.instanced is set up for lit_color_texture_instanced_program, except for 'vao', which you should
+//  set (to a vao made for lit_color_texture_instanced_program->program) if you want instanced drawing.
+// NOTE: likewise, pipeline.multi_draw is set up for lit_color_texture_multi_draw_program; set its 'vao'
+//  (to a vao made for lit_color_texture_multi_draw_program->program) to batch different meshes into one call.
 extern Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
+
+//Same as above, but for lit_color_texture_clustered_program (no instanced or multi-draw version):
+// NOTE: call LightGrid::update() and LightGrid::bind() before drawing with this pipeline.
+extern Scene::Drawable::Pipeline lit_color_texture_clustered_program_pipeline;
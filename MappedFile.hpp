@@ -0,0 +1,35 @@
+#pragma once
+
+/*
+ * A MappedFile makes the contents of a file available as a read-only block
+ * of memory (mmap on Linux/macOS, a file mapping on Windows), so loaders can
+ * read data in place rather than copying it into buffers of their own.
+ *
+ * The operating system pages the file in as it is read, and the memory is
+ * released when the MappedFile is destroyed -- so pointers into 'data' must
+ * not outlive it.
+ *
+ * map_chunk() in read_write_chunk.hpp reads chunks out of the mapping.
+ *
+ */
+
+#include <cstddef>
+#include <string>
+
+struct MappedFile {
+	//map a file:
+	// note: will throw if the file can't be opened or mapped
+	MappedFile(std::string const &filename);
+	~MappedFile();
+
+	//(owns the mapping, so copying is not allowed)
+	MappedFile(MappedFile const &) = delete;
+	MappedFile &operator=(MappedFile const &) = delete;
+
+	char const *data = nullptr; //file contents (nullptr if the file is empty)
+	size_t size = 0; //in bytes
+
+	//-- internals --
+	void *file_handle = nullptr; //(Windows)
+	void *mapping_handle = nullptr; //(Windows)
+};
@@ -1,56 +1,314 @@
 #include "Mesh.hpp"
 #include "read_write_chunk.hpp"
+#include "deflate_chunk.hpp"
+#include "Jobs.hpp"
 
 #include <glm/glm.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define MESH_BOUNDS_SSE
+#elif defined(__ARM_NEON)
+	#include <arm_neon.h>
+	#define MESH_BOUNDS_NEON
+#endif
+
 #include <stdexcept>
 #include <fstream>
 #include <iostream>
 #include <vector>
 #include <string>
-#include <set>
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <cstddef>
+#include <cstring>
+#include <cassert>
+#include <exception>
+
+//vertex format of .pnct (and .ipnct) files:
+struct Vertex {
+	glm::vec3 Position;
+	glm::vec3 Normal;
+	glm::u8vec4 Color;
+	glm::vec2 TexCoord;
+};
+static_assert(sizeof(Vertex) == 3*4+3*4+4*1+2*4, "Vertex is packed.");
+
+//vertex formats for the compact layouts (see MeshBuffer::Layout):
+struct CompactVertex {
+	glm::vec3 Position;
+	uint32_t Normal; //GL_INT_2_10_10_10_REV
+	glm::u8vec4 Color;
+	uint16_t TexCoord[2]; //half floats
+};
+static_assert(sizeof(CompactVertex) == 3*4+4+4*1+2*2, "CompactVertex is packed.");
+
+struct QuantizedVertex {
+	uint16_t Position[4]; //normalized, relative to the mesh's bounding box (last is padding, to keep the rest aligned)
+	uint32_t Normal; //GL_INT_2_10_10_10_REV
+	glm::u8vec4 Color;
+	uint16_t TexCoord[2]; //half floats
+};
+static_assert(sizeof(QuantizedVertex) == 4*2+4+4*1+2*2, "QuantizedVertex is packed.");
 
-MeshBuffer::MeshBuffer(std::string const &filename) {
-	glGenBuffers(1, &buffer);
+//(CompactQuantized) box that positions are stored relative to:
+// (stored = (position - min) / size, as 16-bit normalized integers; so position = min + size * stored)
+struct PositionBox {
+	glm::vec3 min = glm::vec3(0.0f);
+	glm::vec3 inverse_size = glm::vec3(0.0f); //(0 on flat axes -- and for vertices that no mesh uses)
+};
 
-	std::ifstream file(filename, std::ios::binary);
+static size_t packed_vertex_size(MeshBuffer::Layout layout) {
+	if (layout == MeshBuffer::Full) return sizeof(Vertex);
+	else if (layout == MeshBuffer::Compact) return sizeof(CompactVertex);
+	else return sizeof(QuantizedVertex);
+}
+
+//convert a float to a (IEEE 754 binary16) half float, rounding to nearest even:
+static uint16_t float_to_half(float f) {
+	uint32_t bits = 0;
+	static_assert(sizeof(bits) == sizeof(f), "float is 32 bits");
+	std::memcpy(&bits, &f, sizeof(f));
 
-	GLuint total = 0;
+	uint16_t sign = uint16_t((bits >> 16) & 0x8000);
+	uint32_t exponent = (bits >> 23) & 0xff;
+	uint32_t mantissa = bits & 0x7fffff;
 
-	struct Vertex {
-		glm::vec3 Position;
-		glm::vec3 Normal;
-		glm::u8vec4 Color;
-		glm::vec2 TexCoord;
+	if (exponent == 0xff) { //infinity or NaN
+		return uint16_t(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+	}
+	int32_t half_exponent = int32_t(exponent) - 127 + 15;
+	if (half_exponent >= 0x1f) { //too big => infinity
+		return uint16_t(sign | 0x7c00);
+	}
+	if (half_exponent <= 0) { //too small => denormal (or zero)
+		if (half_exponent < -10) return sign;
+		mantissa |= 0x800000; //(implicit leading one)
+		uint32_t shift = uint32_t(14 - half_exponent);
+		uint32_t half_mantissa = mantissa >> shift;
+		uint32_t rest = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half_mantissa & 1))) half_mantissa += 1;
+		return uint16_t(sign | half_mantissa);
+	}
+	uint32_t half = (uint32_t(half_exponent) << 10) | (mantissa >> 13);
+	uint32_t rest = mantissa & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half += 1; //(may carry into the exponent, which is still correct)
+	return uint16_t(sign | half);
+}
+
+//pack a (unit) normal into GL_INT_2_10_10_10_REV format (as normalized signed integers):
+static uint32_t pack_normal(glm::vec3 const &n) {
+	auto pack = [](float x) -> uint32_t {
+		x = std::max(-1.0f, std::min(1.0f, x));
+		int32_t i = int32_t(std::round(x * 511.0f));
+		return uint32_t(i) & 0x3ff;
 	};
-	static_assert(sizeof(Vertex) == 3*4+3*4+4*1+2*4, "Vertex is packed.");
-	std::vector< Vertex > data;
+	return pack(n.x) | (pack(n.y) << 10) | (pack(n.z) << 20);
+}
 
-	//read + upload data chunk:
-	if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".pnct") {
-		read_chunk(file, "pnct", &data);
+//convert 'count' vertices to the layout that will be uploaded, writing them to 'packed':
+// ('box' is only used by CompactQuantized)
+static void pack_vertices(Vertex const *vertices, size_t count, MeshBuffer::Layout layout, PositionBox const &box, char *packed) {
+	if (layout == MeshBuffer::Full) {
+		if (count) std::memcpy(packed, vertices, count * sizeof(Vertex));
+	} else if (layout == MeshBuffer::Compact) {
+		for (size_t i = 0; i < count; ++i) {
+			Vertex const &v = vertices[i];
+			CompactVertex c;
+			c.Position = v.Position;
+			c.Normal = pack_normal(v.Normal);
+			c.Color = v.Color;
+			c.TexCoord[0] = float_to_half(v.TexCoord.x);
+			c.TexCoord[1] = float_to_half(v.TexCoord.y);
+			std::memcpy(packed + i * sizeof(CompactVertex), &c, sizeof(CompactVertex));
+		}
+	} else { assert(layout == MeshBuffer::CompactQuantized);
+		for (size_t i = 0; i < count; ++i) {
+			Vertex const &v = vertices[i];
+			QuantizedVertex c;
+			glm::vec3 p = glm::clamp((v.Position - box.min) * box.inverse_size, glm::vec3(0.0f), glm::vec3(1.0f));
+			c.Position[0] = uint16_t(std::round(p.x * 65535.0f));
+			c.Position[1] = uint16_t(std::round(p.y * 65535.0f));
+			c.Position[2] = uint16_t(std::round(p.z * 65535.0f));
+			c.Position[3] = 0;
+			c.Normal = pack_normal(v.Normal);
+			c.Color = v.Color;
+			c.TexCoord[0] = float_to_half(v.TexCoord.x);
+			c.TexCoord[1] = float_to_half(v.TexCoord.y);
+			std::memcpy(packed + i * sizeof(QuantizedVertex), &c, sizeof(QuantizedVertex));
+		}
+	}
+}
 
-		//upload data:
-		glBindBuffer(GL_ARRAY_BUFFER, buffer);
-		glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(Vertex), data.data(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+//grow the box [*min_, *max_] to include the positions of 'count' vertices:
+// (with SSE or NEON, each position -- plus the first component of the normal after it, which is ignored -- is one 4-wide load)
+static void grow_bounds(Vertex const *vertices, uint32_t count, glm::vec3 *min_, glm::vec3 *max_) {
+	assert(min_ && max_);
+#if defined(MESH_BOUNDS_SSE)
+	__m128 lo = _mm_setr_ps(min_->x, min_->y, min_->z, 0.0f);
+	__m128 hi = _mm_setr_ps(max_->x, max_->y, max_->z, 0.0f);
+	__m128 lo2 = lo, hi2 = hi; //(two vertices at a time, so the min/max chains overlap)
+	uint32_t i = 0;
+	for (; i + 2 <= count; i += 2) {
+		__m128 a = _mm_loadu_ps(&vertices[i].Position.x);
+		__m128 b = _mm_loadu_ps(&vertices[i + 1].Position.x);
+		lo = _mm_min_ps(lo, a);
+		hi = _mm_max_ps(hi, a);
+		lo2 = _mm_min_ps(lo2, b);
+		hi2 = _mm_max_ps(hi2, b);
+	}
+	if (i < count) {
+		__m128 a = _mm_loadu_ps(&vertices[i].Position.x);
+		lo = _mm_min_ps(lo, a);
+		hi = _mm_max_ps(hi, a);
+	}
+	float l[4], h[4];
+	_mm_storeu_ps(l, _mm_min_ps(lo, lo2));
+	_mm_storeu_ps(h, _mm_max_ps(hi, hi2));
+	*min_ = glm::vec3(l[0], l[1], l[2]);
+	*max_ = glm::vec3(h[0], h[1], h[2]);
+#elif defined(MESH_BOUNDS_NEON)
+	float l[4] = {min_->x, min_->y, min_->z, 0.0f};
+	float h[4] = {max_->x, max_->y, max_->z, 0.0f};
+	float32x4_t lo = vld1q_f32(l), hi = vld1q_f32(h);
+	float32x4_t lo2 = lo, hi2 = hi;
+	uint32_t i = 0;
+	for (; i + 2 <= count; i += 2) {
+		float32x4_t a = vld1q_f32(&vertices[i].Position.x);
+		float32x4_t b = vld1q_f32(&vertices[i + 1].Position.x);
+		lo = vminq_f32(lo, a);
+		hi = vmaxq_f32(hi, a);
+		lo2 = vminq_f32(lo2, b);
+		hi2 = vmaxq_f32(hi2, b);
+	}
+	if (i < count) {
+		float32x4_t a = vld1q_f32(&vertices[i].Position.x);
+		lo = vminq_f32(lo, a);
+		hi = vmaxq_f32(hi, a);
+	}
+	vst1q_f32(l, vminq_f32(lo, lo2));
+	vst1q_f32(h, vmaxq_f32(hi, hi2));
+	*min_ = glm::vec3(l[0], l[1], l[2]);
+	*max_ = glm::vec3(h[0], h[1], h[2]);
+#else
+	for (uint32_t i = 0; i < count; ++i) {
+		*min_ = glm::min(*min_, vertices[i].Position);
+		*max_ = glm::max(*max_, vertices[i].Position);
+	}
+#endif
+}
 
-		total = GLuint(data.size()); //store total for later checks on index
+//contents of a mesh file:
+// (vertices aren't read with the rest, but a block at a time as they are uploaded; see stream_vertices)
+struct MeshFile {
+	uint32_t vertex_count = 0;
+	std::ifstream file; //(kept open so uncompressed vertices can be read from it..)
+	std::streampos vertices_at = 0; //(..starting here)
+	DeflatedChunk deflated_vertices; //(compressed vertices are held compressed instead)
+	bool bounds_known = false; //were mesh bounds stored in the file? (otherwise stream_vertices finds them)
+	GLenum index_type = GL_NONE; //GL_NONE for .pnct files
+	std::vector< uint16_t > indices16; //(if index_type is GL_UNSIGNED_SHORT)
+	std::vector< uint32_t > indices32; //(if index_type is GL_UNSIGNED_INT)
+	std::map< std::string, Mesh > meshes;
 
-		//store attrib locations:
-		Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
-		Normal = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Normal));
-		Color = Attrib(4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), offsetof(Vertex, Color));
-		TexCoord = Attrib(2, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, TexCoord));
-	} else {
-		throw std::runtime_error("Unknown file type '" + filename + "'");
+	void const *index_data() const {
+		return (index_type == GL_UNSIGNED_SHORT ? static_cast< void const * >(indices16.data()) : static_cast< void const * >(indices32.data()));
+	}
+	size_t index_size() const { //(in bytes)
+		return (index_type == GL_UNSIGNED_SHORT ? 2 : 4);
 	}
+	size_t index_bytes() const {
+		return indices16.size() * 2 + indices32.size() * 4;
+	}
+};
+
+//read vertex data (and indices) and mesh ranges from a file (throws on errors):
+// (any chunk may be compressed -- see deflate_chunk.hpp; vertices are read later, by stream_vertices, which also finds mesh bounds if the file doesn't store them)
+static void read_mesh_file(std::string const &filename, MeshFile *data_) {
+	assert(data_);
+	auto &data = *data_;
+
+	auto &file = data.file;
+	file.open(filename, std::ios::binary);
+
+	auto ends_with = [&filename](std::string const &suffix) {
+		return filename.size() >= suffix.size() && filename.substr(filename.size() - suffix.size()) == suffix;
+	};
+
+	//vertices are skipped over (or, if they are compressed, left compressed):
+	auto read_vertices = [&]() {
+		if (next_chunk_is_deflated(file)) {
+			read_deflated_chunk(file, "pnct", sizeof(Vertex), &data.deflated_vertices);
+			data.vertex_count = uint32_t(data.deflated_vertices.size / sizeof(Vertex));
+		} else {
+			struct ChunkHeader {
+				char magic[4] = {'\0', '\0', '\0', '\0'};
+				uint32_t size = 0;
+			};
+			static_assert(sizeof(ChunkHeader) == 8, "header is packed");
+			ChunkHeader header;
+			if (!file.read(reinterpret_cast< char * >(&header), sizeof(header))) {
+				throw std::runtime_error("Failed to read chunk header");
+			}
+			if (std::string(header.magic, 4) != "pnct") {
+				throw std::runtime_error("Unexpected magic number in chunk");
+			}
+			if (header.size % sizeof(Vertex) != 0) {
+				throw std::runtime_error("Size of chunk not divisible by element size");
+			}
+			data.vertex_count = header.size / sizeof(Vertex);
+			data.vertices_at = file.tellg();
+			//(if the file is cut short, reading the next chunk will fail)
+			file.seekg(header.size, std::ios::cur);
+		}
+	};
+
+	//magic number of the next chunk (or of the chunk it wraps), or "" if there isn't one:
+	auto next_magic = [&]() {
+		char header[12] = {'\0'};
+		std::streampos at = file.tellg();
+		file.read(header, 12);
+		size_t got = size_t(file.gcount());
+		file.clear();
+		file.seekg(at);
+		if (got >= 4 && std::string(header, 4) != "zlib") return std::string(header, 4);
+		if (got >= 12) return std::string(header + 8, 4);
+		return std::string();
+	};
+
+	//(optional) bounds chunk after the index, one entry per index entry (written by index-meshes):
+	struct BoundsEntry {
+		glm::vec3 min, max;
+		float radius; //of a sphere around (min + max) / 2
+	};
+	static_assert(sizeof(BoundsEntry) == 28, "Bounds entry should be packed");
+	std::vector< BoundsEntry > bounds;
+	auto read_bounds = [&](size_t entries) {
+		if (next_magic() != "bnd0") return;
+		read_chunk_maybe_deflated(file, "bnd0", &bounds);
+		if (bounds.size() != entries) {
+			throw std::runtime_error("bounds chunk has " + std::to_string(bounds.size()) + " entries for " + std::to_string(entries) + " meshes");
+		}
+		data.bounds_known = true;
+	};
+	auto set_bounds = [&](Mesh *mesh, size_t entry) {
+		if (!data.bounds_known) return;
+		mesh->min = bounds[entry].min;
+		mesh->max = bounds[entry].max;
+		mesh->radius = bounds[entry].radius;
+	};
 
 	std::vector< char > strings;
-	read_chunk(file, "str0", &strings);
 
-	{ //read index chunk, add to meshes:
+	if (ends_with(".pnct")) {
+		read_vertices();
+		GLuint total = data.vertex_count; //store total for later checks on index
+
+		read_chunk_maybe_deflated(file, "str0", &strings);
+
+		//read index chunk, add to meshes:
 		struct IndexEntry {
 			uint32_t name_begin, name_end;
 			uint32_t vertex_begin, vertex_end;
@@ -58,9 +316,11 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		static_assert(sizeof(IndexEntry) == 16, "Index entry should be packed");
 
 		std::vector< IndexEntry > index;
-		read_chunk(file, "idx0", &index);
+		read_chunk_maybe_deflated(file, "idx0", &index);
+		read_bounds(index.size());
 
-		for (auto const &entry : index) {
+		for (uint32_t i = 0; i < index.size(); ++i) {
+			IndexEntry const &entry = index[i];
 			if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
 				throw std::runtime_error("index entry has out-of-range name begin/end");
 			}
@@ -72,65 +332,696 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 			mesh.type = GL_TRIANGLES;
 			mesh.start = entry.vertex_begin;
 			mesh.count = entry.vertex_end - entry.vertex_begin;
-			for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
-				mesh.min = glm::min(mesh.min, data[v].Position);
-				mesh.max = glm::max(mesh.max, data[v].Position);
+			set_bounds(&mesh, i);
+			bool inserted = data.meshes.insert(std::make_pair(name, mesh)).second;
+			if (!inserted) {
+				std::cerr << "WARNING: mesh name '" + name + "' in filename '" + filename + "' collides with existing mesh." << std::endl;
 			}
-			bool inserted = meshes.insert(std::make_pair(name, mesh)).second;
+		}
+	} else if (ends_with(".ipnct")) {
+		read_vertices();
+		GLuint total = data.vertex_count;
+
+		//indices are 16- or 32-bit, depending on the magic number of the next chunk:
+		if (next_magic() == "ix16") {
+			data.index_type = GL_UNSIGNED_SHORT;
+			read_chunk_maybe_deflated(file, "ix16", &data.indices16);
+		} else {
+			data.index_type = GL_UNSIGNED_INT;
+			read_chunk_maybe_deflated(file, "ix32", &data.indices32);
+		}
+		GLuint index_total = GLuint(data.indices16.size() + data.indices32.size());
+		auto get_index = [&data](uint32_t i) -> uint32_t {
+			return (data.index_type == GL_UNSIGNED_SHORT ? data.indices16[i] : data.indices32[i]);
+		};
+
+		read_chunk_maybe_deflated(file, "str0", &strings);
+
+		//read index chunk, add to meshes:
+		struct IndexedEntry {
+			uint32_t name_begin, name_end;
+			uint32_t vertex_begin, vertex_end;
+			uint32_t index_begin, index_end;
+		};
+		static_assert(sizeof(IndexedEntry) == 24, "Indexed entry should be packed");
+
+		std::vector< IndexedEntry > index;
+		read_chunk_maybe_deflated(file, "idx1", &index);
+		read_bounds(index.size());
+
+		for (uint32_t e = 0; e < index.size(); ++e) {
+			IndexedEntry const &entry = index[e];
+			if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
+				throw std::runtime_error("index entry has out-of-range name begin/end");
+			}
+			if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= total)) {
+				throw std::runtime_error("index entry has out-of-range vertex start/count");
+			}
+			if (!(entry.index_begin <= entry.index_end && entry.index_end <= index_total)) {
+				throw std::runtime_error("index entry has out-of-range index start/count");
+			}
+			std::string name(&strings[0] + entry.name_begin, &strings[0] + entry.name_end);
+			Mesh mesh;
+			mesh.type = GL_TRIANGLES;
+			mesh.start = entry.index_begin;
+			mesh.count = entry.index_end - entry.index_begin;
+			mesh.index_type = data.index_type;
+			mesh.base_vertex = GLint(entry.vertex_begin);
+			mesh.vertex_count = entry.vertex_end - entry.vertex_begin;
+			set_bounds(&mesh, e);
+			for (uint32_t i = entry.index_begin; i < entry.index_end; ++i) {
+				uint32_t v = get_index(i);
+				if (v >= mesh.vertex_count) {
+					throw std::runtime_error("mesh '" + name + "' has out-of-range index (" + std::to_string(v) + ")");
+				}
+			}
+			bool inserted = data.meshes.insert(std::make_pair(name, mesh)).second;
 			if (!inserted) {
 				std::cerr << "WARNING: mesh name '" + name + "' in filename '" + filename + "' collides with existing mesh." << std::endl;
 			}
 		}
+	} else {
+		throw std::runtime_error("Unknown file type '" + filename + "'");
 	}
 
 	if (file.peek() != EOF) {
 		std::cerr << "WARNING: trailing data in mesh file '" << filename << "'" << std::endl;
 	}
+}
+
+//vertices are read (and converted) this many at a time:
+static constexpr uint32_t VertexBlock = 32768;
+//..in pieces of this many, which are converted (and bounded) in parallel on Jobs::shared():
+static constexpr uint32_t VertexPiece = 4096;
+
+//read a file's vertices, converting them to 'layout' and writing them to 'to' (data.vertex_count * packed_vertex_size(layout) bytes -- e.g., a mapped range of an arena),
+// and fill in the bounds of data.meshes along the way (unless the file stored them):
+// (vertices are read -- or inflated -- a block at a time, so they are never all in memory at once;
+//  CompactQuantized positions are stored relative to mesh bounds, so if the file doesn't store bounds, the vertices are read twice)
+static void stream_vertices(MeshFile &data, MeshBuffer::Layout layout, char *to) {
+	size_t stride = packed_vertex_size(layout);
+
+	//bounds are found for each distinct vertex range, sweeping through the ranges in order of their first vertex:
+	// (the vertices of an indexed mesh are its range, since index-meshes doesn't store unused vertices)
+	struct Box {
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+	};
+	struct Range {
+		uint32_t begin, end;
+		Box box;
+	};
+	auto mesh_range = [](Mesh const &mesh) {
+		if (mesh.index_type == GL_NONE) return std::make_pair(mesh.start, mesh.start + mesh.count);
+		else return std::make_pair(GLuint(mesh.base_vertex), GLuint(mesh.base_vertex) + mesh.vertex_count);
+	};
+	std::vector< Range > ranges;
+	if (!data.bounds_known) {
+		for (auto const &nm : data.meshes) {
+			auto r = mesh_range(nm.second);
+			if (r.first < r.second) ranges.emplace_back(Range{r.first, r.second, Box()});
+		}
+	}
+	std::sort(ranges.begin(), ranges.end(), [](Range const &a, Range const &b) {
+		return a.begin != b.begin ? a.begin < b.begin : a.end < b.end;
+	});
+	ranges.erase(std::unique(ranges.begin(), ranges.end(), [](Range const &a, Range const &b) {
+		return a.begin == b.begin && a.end == b.end;
+	}), ranges.end());
+	uint32_t first_range = 0; //ranges before this one end before the current block
+
+	//(CompactQuantized) vertices are packed relative to the box of the mesh that uses them:
+	// (meshes whose vertex ranges overlap share one box, so that every vertex has just one)
+	struct Segment {
+		uint32_t begin, end;
+		PositionBox box;
+	};
+	std::vector< Segment > segments; //sorted, disjoint
+	auto quantize_meshes = [&]() {
+		std::vector< std::pair< Range, Mesh * > > boxes;
+		for (auto &nm : data.meshes) {
+			auto r = mesh_range(nm.second);
+			if (r.first < r.second) boxes.emplace_back(Range{r.first, r.second, Box{nm.second.min, nm.second.max}}, &nm.second);
+		}
+		std::sort(boxes.begin(), boxes.end(), [](auto const &a, auto const &b) {
+			return a.first.begin < b.first.begin;
+		});
+		for (uint32_t i = 0; i < boxes.size(); /* later */) {
+			//gather the run of meshes whose ranges overlap this one's (or each other's):
+			Range merged = boxes[i].first;
+			uint32_t j = i + 1;
+			while (j < boxes.size() && boxes[j].first.begin < merged.end) {
+				merged.end = std::max(merged.end, boxes[j].first.end);
+				merged.box.min = glm::min(merged.box.min, boxes[j].first.box.min);
+				merged.box.max = glm::max(merged.box.max, boxes[j].first.box.max);
+				++j;
+			}
+			glm::vec3 size = glm::max(merged.box.max - merged.box.min, glm::vec3(0.0f));
+			Segment segment;
+			segment.begin = merged.begin;
+			segment.end = merged.end;
+			segment.box.min = merged.box.min;
+			for (uint32_t c = 0; c < 3; ++c) {
+				segment.box.inverse_size[c] = (size[c] > 0.0f ? 1.0f / size[c] : 0.0f);
+			}
+			segments.emplace_back(segment);
+			for (; i < j; ++i) {
+				boxes[i].second->position_scale = size;
+				boxes[i].second->position_offset = merged.box.min;
+			}
+		}
+	};
+	bool quantized = (layout == MeshBuffer::CompactQuantized);
+	if (quantized && data.bounds_known) quantize_meshes();
+
+	//pack vertices [begin, end) (of a block starting at vertex 'block_begin'):
+	auto pack = [&](Vertex const *vertices, uint32_t block_begin, uint32_t begin, uint32_t end) {
+		auto pack_part = [&](uint32_t part_begin, uint32_t part_end, PositionBox const &box) {
+			pack_vertices(vertices + (part_begin - block_begin), part_end - part_begin, layout, box, to + size_t(part_begin) * stride);
+		};
+		if (!quantized) {
+			pack_part(begin, end, PositionBox());
+			return;
+		}
+		auto s = std::upper_bound(segments.begin(), segments.end(), begin, [](uint32_t v, Segment const &segment) {
+			return v < segment.end;
+		});
+		for (uint32_t v = begin; v < end; ++s) {
+			if (s == segments.end() || s->begin >= end) {
+				pack_part(v, end, PositionBox()); //(vertices no mesh uses)
+				break;
+			}
+			if (v < s->begin) pack_part(v, s->begin, PositionBox());
+			v = std::max(v, s->begin);
+			uint32_t part_end = std::min(end, s->end);
+			pack_part(v, part_end, s->box);
+			v = part_end;
+		}
+	};
+
+	//box of the part of a range in one piece of a block:
+	struct RangePart {
+		uint32_t range;
+		Box box;
+	};
+	std::vector< std::vector< RangePart > > piece_parts; //(per piece of the current block)
+
+	bool bounding = !data.bounds_known; //find bounds in this pass?
+	bool packing = !(quantized && bounding); //pack vertices in this pass?
+
+	//handle vertices [begin, begin + count):
+	auto block = [&](Vertex const *vertices, uint32_t begin, uint32_t count) {
+		uint32_t end = begin + count;
+		while (first_range < ranges.size() && ranges[first_range].end <= begin) ++first_range;
+
+		//convert pieces of the block (and find boxes of the parts of ranges in each) in parallel:
+		uint32_t pieces = (count + VertexPiece - 1) / VertexPiece;
+		if (piece_parts.size() < pieces) piece_parts.resize(pieces);
+		Jobs::shared().parallel_for(pieces, 1, [&](uint32_t pieces_begin, uint32_t pieces_end, uint32_t) {
+			for (uint32_t p = pieces_begin; p < pieces_end; ++p) {
+				uint32_t piece_begin = begin + p * VertexPiece;
+				uint32_t piece_end = std::min(end, piece_begin + VertexPiece);
+				auto &parts = piece_parts[p];
+				parts.clear();
+				for (uint32_t r = first_range; bounding && r < ranges.size() && ranges[r].begin < piece_end; ++r) {
+					uint32_t v_begin = std::max(ranges[r].begin, piece_begin);
+					uint32_t v_end = std::min(ranges[r].end, piece_end);
+					if (v_begin >= v_end) continue;
+					RangePart part;
+					part.range = r;
+					grow_bounds(vertices + (v_begin - begin), v_end - v_begin, &part.box.min, &part.box.max);
+					parts.emplace_back(part);
+				}
+				if (packing) pack(vertices, begin, piece_begin, piece_end);
+			}
+		});
+
+		//(ranges can span pieces, so parts are merged here rather than by the jobs)
+		for (uint32_t p = 0; p < pieces; ++p) {
+			for (auto const &part : piece_parts[p]) {
+				Box &box = ranges[part.range].box;
+				box.min = glm::min(box.min, part.box.min);
+				box.max = glm::max(box.max, part.box.max);
+			}
+		}
+	};
+
+	auto read_blocks = [&]() {
+		if (data.deflated_vertices.size) {
+			std::vector< Vertex > vertices(VertexBlock);
+			uint32_t begin = 0;
+			inflate_blocks(data.deflated_vertices, VertexBlock * sizeof(Vertex), [&](char const *bytes, size_t size) {
+				uint32_t count = uint32_t(size / sizeof(Vertex));
+				std::memcpy(vertices.data(), bytes, count * sizeof(Vertex)); //(copied, so the vertices are aligned)
+				block(vertices.data(), begin, count);
+				begin += count;
+			});
+		} else {
+			std::vector< Vertex > vertices(std::min(VertexBlock, data.vertex_count));
+			data.file.clear(); //(reading the rest of the file left it at the end)
+			data.file.seekg(data.vertices_at);
+			for (uint32_t begin = 0; begin < data.vertex_count; begin += VertexBlock) {
+				uint32_t count = std::min(VertexBlock, data.vertex_count - begin);
+				if (!data.file.read(reinterpret_cast< char * >(vertices.data()), count * sizeof(Vertex))) {
+					throw std::runtime_error("Failed to read chunk data.");
+				}
+				block(vertices.data(), begin, count);
+			}
+		}
+	};
+	read_blocks();
+
+	if (data.bounds_known) return;
+
+	for (auto &nm : data.meshes) {
+		auto r = mesh_range(nm.second);
+		if (!(r.first < r.second)) continue;
+		auto f = std::lower_bound(ranges.begin(), ranges.end(), r, [](Range const &a, std::pair< GLuint, GLuint > const &b) {
+			return a.begin != b.first ? a.begin < b.first : a.end < b.second;
+		});
+		assert(f != ranges.end() && f->begin == r.first && f->end == r.second);
+		nm.second.min = f->box.min;
+		nm.second.max = f->box.max;
+		//(a tighter sphere would take a second pass over the vertices, so that's left to index-meshes)
+		nm.second.radius = 0.5f * glm::length(f->box.max - f->box.min);
+	}
+
+	//now that the bounds are known, quantized vertices can be packed:
+	if (!packing) {
+		quantize_meshes();
+		bounding = false;
+		packing = true;
+		first_range = 0;
+		read_blocks();
+	}
+}
+
+//---------------------------------------------
+//MeshArena:
+
+//every arena made by MeshArena::get:
+// (arenas live as long as the program, like the buffers and vertex arrays that refer to them --
+//  and so does this map, since forget_program may be called from the destructors of other statics)
+static std::map< MeshBuffer::Layout, MeshArena * > &all_arenas() {
+	static std::map< MeshBuffer::Layout, MeshArena * > *arenas = new std::map< MeshBuffer::Layout, MeshArena * >();
+	return *arenas;
+}
+
+MeshArena &MeshArena::get(MeshBuffer::Layout layout) {
+	MeshArena *&arena = all_arenas()[layout];
+	if (!arena) arena = new MeshArena(packed_vertex_size(layout));
+	return *arena;
+}
+
+void MeshArena::forget_program(GLuint program) {
+	for (auto &la : all_arenas()) {
+		la.second->vaos.erase(program);
+	}
+}
+
+MeshArena::MeshArena(size_t vertex_size) {
+	glGenBuffers(1, &vertices.buffer);
+	vertices.granule = vertex_size;
+	glGenBuffers(1, &indices.buffer);
+	indices.granule = 4; //(so ranges can hold 16- or 32-bit indices)
+}
+
+size_t MeshArena::Heap::allocate(size_t size) {
+	size = (size + granule - 1) / granule * granule;
+	if (size == 0) return 0;
+
+	//first fit from released ranges:
+	for (auto f = free.begin(); f != free.end(); ++f) {
+		if (f->second < size) continue;
+		size_t offset = f->first;
+		f->first += size;
+		f->second -= size;
+		if (f->second == 0) free.erase(f);
+		return offset;
+	}
+
+	//otherwise, from the end (growing the buffer if needed):
+	if (used + size > capacity) {
+		size_t new_capacity = std::max(std::max(capacity * 2, used + size), size_t(1) << 20);
+		new_capacity = (new_capacity + granule - 1) / granule * granule;
+
+		//re-specify the buffer with its old contents (keeping its name, so vertex arrays using it stay valid):
+		// (copy targets are used so no vertex array's element array binding is disturbed)
+		GLuint temp = 0;
+		if (used) {
+			glGenBuffers(1, &temp);
+			glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, temp);
+			glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(used), nullptr, GL_STATIC_COPY);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, GLsizeiptr(used));
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(new_capacity), nullptr, GL_STATIC_DRAW);
+		if (used) {
+			glBindBuffer(GL_COPY_READ_BUFFER, temp);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, GLsizeiptr(used));
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			glDeleteBuffers(1, &temp);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		capacity = new_capacity;
+	}
+	size_t offset = used;
+	used += size;
+	return offset;
+}
+
+void MeshArena::Heap::release(size_t offset, size_t size) {
+	size = (size + granule - 1) / granule * granule;
+	if (size == 0) return;
+	assert(offset + size <= used);
+
+	//insert in order, merging with neighbors:
+	auto f = std::lower_bound(free.begin(), free.end(), std::make_pair(offset, size_t(0)));
+	f = free.insert(f, std::make_pair(offset, size));
+	if (f + 1 != free.end() && f->first + f->second == (f + 1)->first) {
+		f->second += (f + 1)->second;
+		free.erase(f + 1);
+	}
+	if (f != free.begin() && (f - 1)->first + (f - 1)->second == f->first) {
+		(f - 1)->second += f->second;
+		f = free.erase(f) - 1;
+	}
+	//give back space at the end:
+	if (f->first + f->second == used) {
+		used = f->first;
+		free.erase(f);
+	}
+}
+
+void MeshArena::Heap::upload(size_t offset, size_t size, void const *data) {
+	if (size == 0) return;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, GLintptr(offset), GLsizeiptr(size), data);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+char *MeshArena::Heap::map(size_t offset, size_t size) {
+	assert(size > 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	//(the range is new, so its old contents can be thrown away)
+	void *mapped = glMapBufferRange(GL_COPY_WRITE_BUFFER, GLintptr(offset), GLsizeiptr(size), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	if (!mapped) throw std::runtime_error("Failed to map mesh arena buffer.");
+	return reinterpret_cast< char * >(mapped);
+}
+
+void MeshArena::Heap::unmap() {
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	GLboolean ok = glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	//(the driver can lose mapped data, e.g., on a display mode change)
+	if (!ok) throw std::runtime_error("Mesh arena buffer contents were lost while mapped.");
+}
+
+//---------------------------------------------
+//MeshBuffer:
+
+//move mesh ranges read from a file to where the file's data was put in the arena:
+static void offset_meshes(std::map< std::string, Mesh > *meshes_, size_t vertex_offset, size_t vertex_size, size_t index_offset) {
+	assert(meshes_);
+	for (auto &nm : *meshes_) {
+		Mesh &mesh = nm.second;
+		if (mesh.index_type == GL_NONE) {
+			mesh.start += GLuint(vertex_offset / vertex_size);
+		} else {
+			mesh.base_vertex += GLint(vertex_offset / vertex_size);
+			mesh.start += GLuint(index_offset / (mesh.index_type == GL_UNSIGNED_SHORT ? 2 : 4));
+		}
+	}
+}
+
+//hash of a mesh name (FNV-1a):
+static uint64_t hash_name(std::string const &name) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (char c : name) {
+		hash = (hash ^ uint8_t(c)) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+//read a file's vertices straight into a new range of an arena, through a mapping (see stream_vertices), returning the range's offset:
+// (if anything goes wrong, the range is released again before the exception is passed on)
+static size_t upload_vertices(MeshArena::Heap &heap, MeshFile &data, MeshBuffer::Layout layout, size_t bytes) {
+	size_t offset = heap.allocate(bytes);
+	if (bytes == 0) return offset;
+
+	std::exception_ptr failed;
+	char *mapped = nullptr;
+	try {
+		mapped = heap.map(offset, bytes);
+		stream_vertices(data, layout, mapped);
+	} catch (...) {
+		failed = std::current_exception();
+	}
+	if (mapped) {
+		try {
+			heap.unmap();
+		} catch (...) {
+			if (!failed) failed = std::current_exception();
+		}
+	}
+	if (failed) {
+		heap.release(offset, bytes);
+		std::rethrow_exception(failed);
+	}
+	return offset;
+}
+
+MeshBuffer::MeshBuffer(std::string const &filename, Layout layout_) : layout(layout_) {
+	arena = &MeshArena::get(layout);
+	buffer = arena->vertices.buffer;
+
+	MeshFile data;
+	read_mesh_file(filename, &data);
+
+	//convert vertices straight into their range of the arena (inflating them on the way, if they are compressed):
+	vertex_bytes = data.vertex_count * packed_vertex_size(layout);
+	vertex_offset = upload_vertices(arena->vertices, data, layout, vertex_bytes);
+
+	if (data.index_type != GL_NONE) {
+		index_type = data.index_type;
+		index_buffer = arena->indices.buffer;
+		index_bytes = data.index_bytes();
+		index_offset = arena->indices.allocate(index_bytes);
+		arena->indices.upload(index_offset, index_bytes, data.index_data());
+	}
+
+	offset_meshes(&data.meshes, vertex_offset, packed_vertex_size(layout), index_offset);
+
+	//meshes get handles in name order:
+	mesh_table.reserve(data.meshes.size());
+	mesh_names.reserve(data.meshes.size());
+	name_hashes.reserve(data.meshes.size());
+	for (auto const &nm : data.meshes) {
+		name_hashes.emplace_back(NameHash{hash_name(nm.first), Handle(mesh_table.size())});
+		mesh_table.emplace_back(nm.second);
+		mesh_names.emplace_back(nm.first);
+	}
+	std::sort(name_hashes.begin(), name_hashes.end(), [](NameHash const &a, NameHash const &b) {
+		return a.hash != b.hash ? a.hash < b.hash : a.handle < b.handle;
+	});
+
+	//store attrib locations:
+	if (layout == Full) {
+		Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
+		Normal = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Normal));
+		Color = Attrib(4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), offsetof(Vertex, Color));
+		TexCoord = Attrib(2, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, TexCoord));
+	} else if (layout == Compact) {
+		Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(CompactVertex), offsetof(CompactVertex, Position));
+		Normal = Attrib(4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(CompactVertex), offsetof(CompactVertex, Normal));
+		Color = Attrib(4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(CompactVertex), offsetof(CompactVertex, Color));
+		TexCoord = Attrib(2, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactVertex), offsetof(CompactVertex, TexCoord));
+	} else { assert(layout == CompactQuantized);
+		//(unsigned, since GL 3.3 and later versions convert signed normalized integers differently)
+		Position = Attrib(3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, Position));
+		Normal = Attrib(4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, Normal));
+		Color = Attrib(4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, Color));
+		TexCoord = Attrib(2, GL_HALF_FLOAT, GL_FALSE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, TexCoord));
+	}
 
 	/* //DEBUG:
 	std::cout << "File '" << filename << "' contained meshes";
-	for (auto const &m : meshes) {
-		if (&m.second == &meshes.rbegin()->second && meshes.size() > 1) std::cout << " and";
-		std::cout << " '" << m.first << "'";
-		if (&m.second != &meshes.rbegin()->second) std::cout << ",";
+	for (Handle h = 0; h < mesh_count(); ++h) {
+		if (h + 1 == mesh_count() && mesh_count() > 1) std::cout << " and";
+		std::cout << " '" << name(h) << "'";
+		if (h + 1 != mesh_count()) std::cout << ",";
 	}
 	std::cout << std::endl;
 	*/
 }
 
+uint32_t MeshBuffer::reload(std::string const &filename) {
+	//read everything first, so a bad file leaves this buffer alone:
+	MeshFile data;
+	read_mesh_file(filename, &data);
+	size_t stride = packed_vertex_size(layout);
+	std::map< std::string, Mesh > &fresh = data.meshes; //(bounds filled in by stream_vertices, below)
+
+	uint32_t uploaded = 0;
+	if (data.vertex_count * stride == vertex_bytes && data.index_bytes() == index_bytes && data.index_type == index_type) {
+		//(the vertices are needed in memory to compare them)
+		std::vector< char > packed(vertex_bytes);
+		stream_vertices(data, layout, packed.data());
+
+		//compare against what is in the arena now, and upload only the meshes that differ:
+		// (reading back waits for the GPU, but reloads are rare)
+		auto read_back = [](MeshArena::Heap const &heap, size_t offset, size_t size) {
+			std::vector< char > old(size);
+			if (size) {
+				glBindBuffer(GL_COPY_READ_BUFFER, heap.buffer);
+				glGetBufferSubData(GL_COPY_READ_BUFFER, GLintptr(offset), GLsizeiptr(size), old.data());
+				glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			}
+			return old;
+		};
+		std::vector< char > old_vertices = read_back(arena->vertices, vertex_offset, vertex_bytes);
+		std::vector< char > old_indices = read_back(arena->indices, index_offset, index_bytes);
+
+		//upload bytes [offset, offset + size) of 'from' (to the same place in this buffer's range of 'heap') if they differ from 'old':
+		auto upload_if_changed = [](MeshArena::Heap &heap, size_t base, size_t offset, size_t size, void const *from, std::vector< char > const &old) {
+			if (size == 0) return false;
+			char const *bytes = reinterpret_cast< char const * >(from) + offset;
+			if (std::memcmp(old.data() + offset, bytes, size) == 0) return false;
+			heap.upload(base + offset, size, bytes);
+			return true;
+		};
+
+		for (auto const &nm : fresh) {
+			Mesh const &mesh = nm.second;
+			bool changed = false;
+			if (mesh.index_type == GL_NONE) {
+				changed = upload_if_changed(arena->vertices, vertex_offset, mesh.start * stride, mesh.count * stride, packed.data(), old_vertices);
+			} else {
+				changed = upload_if_changed(arena->vertices, vertex_offset, mesh.base_vertex * stride, mesh.vertex_count * stride, packed.data(), old_vertices);
+				changed = upload_if_changed(arena->indices, index_offset, mesh.start * data.index_size(), mesh.count * data.index_size(), data.index_data(), old_indices) || changed;
+			}
+			if (changed) uploaded += 1;
+		}
+	} else {
+		//vertices (or indices) have moved around, so upload everything to new ranges of the arena:
+		// (the old ranges are released for reuse; drawables need to be updated from the new mesh ranges before drawing again)
+		//vertices are streamed into their new range before the old one is released, since reading them may still fail:
+		size_t new_bytes = data.vertex_count * stride;
+		size_t new_offset = upload_vertices(arena->vertices, data, layout, new_bytes);
+		arena->vertices.release(vertex_offset, vertex_bytes);
+		vertex_bytes = new_bytes;
+		vertex_offset = new_offset;
+
+		arena->indices.release(index_offset, index_bytes);
+		index_type = data.index_type;
+		index_buffer = (index_type != GL_NONE ? arena->indices.buffer : 0);
+		index_bytes = data.index_bytes();
+		index_offset = arena->indices.allocate(index_bytes);
+		arena->indices.upload(index_offset, index_bytes, data.index_data());
+
+		uploaded = uint32_t(fresh.size());
+	}
+
+	offset_meshes(&fresh, vertex_offset, stride, index_offset);
+
+	//update mesh ranges in place (so handles stay valid):
+	std::vector< bool > reloaded(mesh_table.size(), false);
+	for (auto const &nm : fresh) {
+		Handle handle = find(nm.first);
+		if (handle != InvalidHandle) {
+			mesh_table[handle] = nm.second;
+			reloaded[handle] = true;
+		} else {
+			add_mesh(nm.first, nm.second);
+		}
+	}
+
+	//meshes that are gone from the file are left empty (their old ranges may have been released, so they can't be drawn):
+	for (Handle handle = 0; handle < reloaded.size(); ++handle) {
+		if (reloaded[handle]) continue;
+		if (mesh_table[handle].count != 0) {
+			std::cerr << "WARNING: mesh '" << mesh_names[handle] << "' is no longer in '" << filename << "'; it is now empty." << std::endl;
+		}
+		Mesh empty;
+		empty.type = mesh_table[handle].type;
+		empty.index_type = index_type;
+		mesh_table[handle] = empty;
+	}
+
+	return uploaded;
+}
+
 const Mesh &MeshBuffer::lookup(std::string const &name) const {
-	auto f = meshes.find(name);
-	if (f == meshes.end()) {
+	Handle handle = find(name);
+	if (handle == InvalidHandle) {
 		throw std::runtime_error("Looking up mesh '" + name + "' that doesn't exist.");
 	}
-	return f->second;
+	return mesh_table[handle];
+}
+
+std::vector< Mesh const * > MeshBuffer::lookup_lods(std::string const &name) const {
+	std::vector< Mesh const * > lods;
+	while (true) {
+		Handle handle = find(name + ".lod" + std::to_string(lods.size() + 1));
+		if (handle == InvalidHandle) break;
+		lods.emplace_back(&mesh_table[handle]);
+	}
+	return lods;
+}
+
+MeshBuffer::Handle MeshBuffer::find(std::string const &name) const {
+	uint64_t hash = hash_name(name);
+	auto f = std::lower_bound(name_hashes.begin(), name_hashes.end(), hash, [](NameHash const &a, uint64_t b) {
+		return a.hash < b;
+	});
+	//(names are only compared for handles with the same hash, which is almost always just the one being looked for)
+	for (; f != name_hashes.end() && f->hash == hash; ++f) {
+		if (mesh_names[f->handle] == name) return f->handle;
+	}
+	return InvalidHandle;
+}
+
+MeshBuffer::Handle MeshBuffer::add_mesh(std::string const &name, Mesh const &mesh) {
+	assert(find(name) == InvalidHandle);
+	Handle handle = Handle(mesh_table.size());
+	mesh_table.emplace_back(mesh);
+	mesh_names.emplace_back(name);
+	NameHash entry{hash_name(name), handle};
+	auto f = std::upper_bound(name_hashes.begin(), name_hashes.end(), entry, [](NameHash const &a, NameHash const &b) {
+		return a.hash < b.hash;
+	});
+	name_hashes.insert(f, entry);
+	return handle;
 }
 
 GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
-	//create a new vertex array object:
-	GLuint vao = 0;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	//Try to bind all attributes in this buffer:
-	std::set< GLuint > bound;
-	glBindBuffer(GL_ARRAY_BUFFER, buffer);
-	auto bind_attribute = [&](char const *name, MeshBuffer::Attrib const &attrib) {
-		if (attrib.size == 0) return; //don't bind empty attribs
-		GLint location = glGetAttribLocation(program, name);
-		if (location == -1) return; //can't bind missing attribs
-		glVertexAttribPointer(location, attrib.size, attrib.type, attrib.normalized, attrib.stride, (GLbyte *)0 + attrib.offset);
-		glEnableVertexAttribArray(location);
-		bound.insert(location);
-	};
-	bind_attribute("Position", Position);
-	bind_attribute("Normal", Normal);
-	bind_attribute("Color", Color);
-	bind_attribute("TexCoord", TexCoord);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-
-	//Check that all active attributes were bound:
+	//every buffer in the arena has the same attributes, so they can all share a vertex array for each program:
+	// (MeshArena::forget_program drops programs that have been deleted, so their names can't pick up stale entries)
+	auto f = arena->vaos.find(program);
+	if (f != arena->vaos.end()) return f->second;
+
+	//find where the program wants the attributes in this buffer:
+	auto location_of = [&](char const *name, MeshBuffer::Attrib const &attrib) -> GLint {
+		if (attrib.size == 0) return -1; //don't bind empty attribs
+		return glGetAttribLocation(program, name); //(-1 for missing attribs, which can't be bound)
+	};
+	std::array< GLint, 4 > locations{
+		location_of("Position", Position),
+		location_of("Normal", Normal),
+		location_of("Color", Color),
+		location_of("TexCoord", TexCoord)
+	};
+
+	//Scene::draw attaches per-instance and per-draw attributes to the (shared) vertex array at fixed locations, which must be left free:
+	for (GLint location : locations) {
+		if (location >= GLint(ReservedLocationsBegin) && location < GLint(ReservedLocationsEnd)) {
+			throw std::runtime_error("ERROR: program puts a mesh attribute at location " + std::to_string(location) + ", which is reserved for per-instance and per-draw attributes.");
+		}
+	}
+
+	//Check that all active attributes will be bound:
 	GLint active = 0;
 	glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &active);
 	assert(active >= 0 && "Doesn't makes sense to have negative active attributes.");
@@ -140,11 +1031,41 @@ GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
 		GLenum type = 0;
 		glGetActiveAttrib(program, i, 100, NULL, &size, &type, name);
 		name[99] = '\0';
+		//matrix attributes hold per-instance data (see Scene::Drawable::Pipeline::Instanced), which isn't stored in mesh buffers:
+		if (type == GL_FLOAT_MAT3 || type == GL_FLOAT_MAT4 || type == GL_FLOAT_MAT4x3) continue;
+		//..as do unsigned integer attributes (per-draw ids, see Scene::Drawable::Pipeline::MultiDraw):
+		if (type == GL_UNSIGNED_INT) continue;
 		GLint location = glGetAttribLocation(program, name);
-		if (!bound.count(GLuint(location))) {
+		if (std::find(locations.begin(), locations.end(), location) == locations.end()) {
 			throw std::runtime_error("ERROR: active attribute '" + std::string(name) + "' in program is not bound.");
 		}
 	}
 
+	//programs that put attributes at the same locations share a vertex array:
+	// (Scene::draw adds instance and draw id attributes at fixed locations that programs' own attributes never use, so sharing doesn't disturb them)
+	GLuint &vao = arena->layout_vaos[locations];
+	if (vao == 0) {
+		//create a new vertex array object:
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		auto bind_attribute = [&](GLint location, MeshBuffer::Attrib const &attrib) {
+			if (location == -1) return;
+			glVertexAttribPointer(location, attrib.size, attrib.type, attrib.normalized, attrib.stride, (GLbyte *)0 + attrib.offset);
+			glEnableVertexAttribArray(location);
+		};
+		bind_attribute(locations[0], Position);
+		bind_attribute(locations[1], Normal);
+		bind_attribute(locations[2], Color);
+		bind_attribute(locations[3], TexCoord);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		//indices come from the element array buffer bound in the vertex array:
+		// (left bound when the vertex array is unbound, so it stays part of the vertex array's state)
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena->indices.buffer);
+		glBindVertexArray(0);
+	}
+
+	arena->vaos.emplace(program, vao);
 	return vao;
 }
@@ -5,50 +5,164 @@
  *  the OpenGL pipeline together.
  * A "MeshBuffer" holds a collection of such meshes (loaded from a file) in
  *  a single OpenGL array buffer. Individual meshes can be looked up by name
- *  using the MeshBuffer::lookup() function.
+ *  using the MeshBuffer::lookup() function, or -- for code that switches
+ *  meshes often -- resolved once to a handle with MeshBuffer::find() and
+ *  then fetched with MeshBuffer::get(), which is just an array index.
+ *
+ * MeshBuffers loaded from indexed (.ipnct) files also have an element array
+ *  buffer, and their meshes are ranges of indices into the vertices.
+ *  (index-meshes makes .ipnct files from .pnct files by welding shared vertices.)
+ *
+ * Chunks of either kind of file may be compressed (see deflate_chunk.hpp).
+ *  Vertices are read (or inflated) from the file a block at a time and
+ *  converted straight into a mapping of the buffer, so loading a mesh file
+ *  never holds all of its vertices in memory.
+ *
+ * Mesh bounds are found while vertices are converted (spread over
+ *  Jobs::shared()), unless the file stores them in a 'bnd0' chunk, as
+ *  index-meshes does.
+ *
+ * MeshBuffers don't own their OpenGL buffers: data from every MeshBuffer with
+ *  the same vertex layout is stored in ranges of one MeshArena's buffers, and
+ *  they share vertex arrays, so drawables made from different files can be
+ *  batched together by Scene::draw.
  *
  */
 
 #include "GL.hpp"
 #include <glm/glm.hpp>
+#include <array>
+#include <cassert>
+#include <cstdint>
 #include <map>
 #include <limits>
+#include <utility>
 #include <string>
+#include <vector>
 
 
 struct Mesh {
 	//Meshes are vertex ranges (and primitive types) in their MeshBuffer:
 
 	GLenum type = GL_TRIANGLES; //type of primitives in mesh
-	GLuint start = 0; //index of first vertex
-	GLuint count = 0; //count of vertices
+	GLuint start = 0; //index of first vertex (or, for indexed meshes, of first index)
+	GLuint count = 0; //count of vertices (or, for indexed meshes, of indices)
+
+	//indexed meshes are drawn with glDrawElementsBaseVertex:
+	GLenum index_type = GL_NONE; //GL_UNSIGNED_SHORT or GL_UNSIGNED_INT for indexed meshes
+	GLint base_vertex = 0; //(indexed meshes) first vertex used; added to every index
+	GLuint vertex_count = 0; //(indexed meshes) number of vertices used
 
 	//Bounding box.
 	//useful for debug visualization and (perhaps, eventually) collision detection:
 	glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
 	glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+	//..and bounding sphere, centered on the box (usually tighter than the box's half-diagonal; 0 for empty meshes):
+	float radius = 0.0f;
+
+	//Position attributes read by shaders map to the positions above as position_offset + position_scale * attribute.
+	//(this is only not the identity for MeshBuffer::CompactQuantized buffers, where attributes are in [0,1] across the mesh's box;
+	// copy these to Scene::Drawable::Pipeline, which folds them into the matrices it sends)
+	glm::vec3 position_scale = glm::vec3(1.0f);
+	glm::vec3 position_offset = glm::vec3(0.0f);
 };
 
+struct MeshArena;
+
 struct MeshBuffer {
+	//how vertices are stored in the buffer:
+	// (attributes are converted when loaded; make_vao_for_program binds whichever layout is used)
+	enum Layout : uint32_t {
+		Full, //36 bytes: float Position[3], Normal[3]; uint8 Color[4]; float TexCoord[2] (same as the file)
+		Compact, //24 bytes: float Position[3]; GL_INT_2_10_10_10_REV Normal; uint8 Color[4]; half TexCoord[2]
+		CompactQuantized, //20 bytes: as Compact, but 16-bit normalized Position[3] relative to each mesh's bounding box (see Mesh::position_scale)
+	};
+
 	//construct from a file:
 	// note: will throw if file fails to read.
-	MeshBuffer(std::string const &filename);
+	MeshBuffer(std::string const &filename, Layout layout = Full);
+
+	//re-read a (re-exported) file, updating meshes in place:
+	// vertex data is re-uploaded with glBufferSubData only for meshes whose vertices (or indices) changed, if the file's data is the same size;
+	// otherwise the data is moved to new ranges of the arena. (vertex arrays from make_vao_for_program stay valid either way.)
+	// meshes that are no longer in the file keep their handles but become empty (count == 0), with a warning.
+	// returns the number of meshes re-uploaded.
+	// note: will throw if the file fails to read, leaving the buffer unchanged.
+	uint32_t reload(std::string const &filename);
 
 	//look up a particular mesh by name:
 	// note: will throw if mesh not found.
 	const Mesh &lookup(std::string const &name) const;
+
+	//look up the coarser levels of detail of a mesh, exported as meshes named 'name.lod1', 'name.lod2', ...:
+	// note: returns levels in order, stopping at the first one that doesn't exist (so meshes without levels give an empty list).
+	std::vector< Mesh const * > lookup_lods(std::string const &name) const;
+
+	//meshes are numbered with handles -- in name order, as loaded; meshes added by reload() get the next handles:
+	// (handles stay valid across reload(), but references to meshes may not if it adds meshes)
+	using Handle = uint32_t;
+	static constexpr Handle InvalidHandle = -1U;
+
+	//find the handle of a mesh by name:
+	// (returns InvalidHandle if mesh not found)
+	Handle find(std::string const &name) const;
+
+	//get a mesh (or its name) by handle:
+	Mesh const &get(Handle handle) const {
+		assert(handle < mesh_table.size());
+		return mesh_table[handle];
+	}
+	std::string const &name(Handle handle) const {
+		assert(handle < mesh_names.size());
+		return mesh_names[handle];
+	}
+	uint32_t mesh_count() const { return uint32_t(mesh_table.size()); }
 	
-	//build a vertex array object that links this vbo to attributes to a program:
+	//get a vertex array object that links this vbo to attributes to a program:
+	// (the vertex array also references the arena's index buffer)
+	// vertex arrays are made once for each arena and shared by all its MeshBuffers -- and by all programs that put the buffer's attributes
+	//  at the same locations -- so this is cheap to call again (no need to keep the result around), but don't delete them.
 	// note: will throw if program defines attributes not contained in this buffer
+	//  (except for matrix-typed and unsigned integer attributes, which are assumed to be per-instance or per-draw data bound elsewhere)
+	// note: will also throw if program puts this buffer's attributes at locations reserved for per-instance and per-draw data
+	//  (ReservedLocationsBegin up to ReservedLocationsEnd, below) -- give them explicit locations below those
+	// note: call MeshArena::forget_program before deleting a program passed here (its name may be re-used)
 	GLuint make_vao_for_program(GLuint program) const;
 
+	//attribute locations that vertex arrays leave free for per-instance and per-draw data (see Scene::Drawable):
+	enum : GLuint {
+		ReservedLocationsBegin = 4,
+		ReservedLocationsEnd = 12, //(one past the last)
+	};
+
 	//This is the OpenGL vertex buffer object containing the mesh data:
+	// (shared with other MeshBuffers with the same layout)
 	GLuint buffer = 0;
+	Layout layout = Full; //(reload() converts vertices to the same layout)
+
+	//Indexed buffers also have an element array buffer (index_buffer is 0 otherwise):
+	GLuint index_buffer = 0;
+	GLenum index_type = GL_NONE; //GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
 
 	//-- internals ---
 
-	//used by the lookup() function:
-	std::map< std::string, Mesh > meshes;
+	//where this buffer's data lives:
+	MeshArena *arena = nullptr;
+	size_t vertex_offset = 0, vertex_bytes = 0; //range of arena->vertices
+	size_t index_offset = 0, index_bytes = 0; //range of arena->indices
+
+	//meshes and their names, by handle:
+	std::vector< Mesh > mesh_table;
+	std::vector< std::string > mesh_names;
+
+	//used by the find() (and lookup()) functions: handles sorted by the hash of their name
+	struct NameHash {
+		uint64_t hash;
+		Handle handle;
+	};
+	std::vector< NameHash > name_hashes;
+	//add a mesh with the next handle (and hash its name):
+	Handle add_mesh(std::string const &name, Mesh const &mesh);
 
 	//These 'Attrib' structures describe the location of various attributes within the buffer (in exactly format wanted by glVertexAttribPointer). They are set when the file is loaded and are used by the "make_vao_for_program" call:
 	struct Attrib {
@@ -68,3 +182,40 @@ struct MeshBuffer {
 	Attrib Color;
 	Attrib TexCoord;
 };
+
+//MeshArena holds the vertices and indices of every MeshBuffer with a given layout:
+struct MeshArena {
+	//get the arena for a layout (created on first use):
+	static MeshArena &get(MeshBuffer::Layout layout);
+	//drop every arena's memo of a program's vertex array (call before deleting the program):
+	static void forget_program(GLuint program);
+
+	MeshArena(size_t vertex_size);
+
+	//ranges of an OpenGL buffer, handed out to MeshBuffers:
+	struct Heap {
+		GLuint buffer = 0;
+		size_t capacity = 0; //size of buffer
+		size_t used = 0; //ranges are allocated from [0, used)
+		size_t granule = 1; //ranges start at (and sizes are rounded up to) multiples of this
+		std::vector< std::pair< size_t, size_t > > free; //(offset, size) of released ranges, in order
+
+		//find room for 'size' bytes, returning the offset:
+		// grows the buffer if needed (by re-specifying it, so the buffer keeps its name)
+		size_t allocate(size_t size);
+		//give a range back for reuse:
+		void release(size_t offset, size_t size);
+		//copy data into part of the buffer:
+		void upload(size_t offset, size_t size, void const *data);
+		//..or write it directly, through a mapping of part of the buffer (which must be unmapped before drawing):
+		// (map throws if the range can't be mapped; unmap throws if the driver lost the data, which then needs to be written again)
+		char *map(size_t offset, size_t size);
+		void unmap();
+	};
+	Heap vertices;
+	Heap indices;
+
+	//vertex arrays (see MeshBuffer::make_vao_for_program):
+	std::map< std::array< GLint, 4 >, GLuint > layout_vaos; //attribute locations (Position, Normal, Color, TexCoord; -1 if unused) -> vertex array
+	std::map< GLuint, GLuint > vaos; //program -> vertex array (from layout_vaos; remembered so each program's attributes are only checked once)
+};
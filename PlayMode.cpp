@@ -12,50 +12,63 @@
 
 #include <random>
 
-GLuint hexapod_meshes_for_lit_color_texture_program = 0;
+//makes a drawable for a mesh, drawn with lit_color_texture_program (used by all the scenes below):
+static void make_lit_drawable(MeshBuffer const &meshes, Scene &scene, Scene::Transform *transform, std::string const &mesh_name) {
+	Mesh const &mesh = meshes.lookup(mesh_name);
+	std::vector< Mesh const * > lods = meshes.lookup_lods(mesh_name);
+
+	scene.drawables.emplace_back(transform);
+	Scene::Drawable &drawable = scene.drawables.back();
+
+	drawable.pipeline = lit_color_texture_program_pipeline;
+
+	//(mesh buffers cache vertex arrays, so they are just looked up here)
+	drawable.pipeline.vao = meshes.make_vao_for_program(drawable.pipeline.program);
+	drawable.pipeline.instanced.vao = meshes.make_vao_for_program(drawable.pipeline.instanced.program);
+	drawable.pipeline.multi_draw.vao = meshes.make_vao_for_program(drawable.pipeline.multi_draw.program);
+	drawable.pipeline.type = mesh.type;
+	drawable.pipeline.start = mesh.start;
+	drawable.pipeline.count = mesh.count;
+	drawable.pipeline.index_type = mesh.index_type;
+	drawable.pipeline.base_vertex = mesh.base_vertex;
+	drawable.pipeline.vertex_count = mesh.vertex_count;
+	drawable.pipeline.position_scale = mesh.position_scale;
+	drawable.pipeline.position_offset = mesh.position_offset;
+
+	//(bounds let Scene::draw skip lights that can't reach this drawable, and pick its level of detail)
+	drawable.bounds_min = mesh.min;
+	drawable.bounds_max = mesh.max;
+	drawable.bounds_radius = mesh.radius;
+
+	//coarser levels of detail (if any were exported), each used below half the screen size of the one before:
+	std::vector< Scene::Drawable::LOD > levels;
+	for (uint32_t i = 0; i < lods.size(); ++i) {
+		levels.emplace_back(Scene::Drawable::LOD{lods[i]->start, lods[i]->count, 0.25f / float(1 << i), lods[i]->base_vertex, lods[i]->vertex_count, lods[i]->position_scale, lods[i]->position_offset});
+	}
+	if (!levels.empty()) drawable.lods = std::move(levels);
+}
+
 Load< MeshBuffer > hexapod_meshes(LoadTagDefault, []() -> MeshBuffer const * {
-	MeshBuffer const *ret = new MeshBuffer(data_path("hexapod.pnct"));
-	hexapod_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program);
-	return ret;
+	return new MeshBuffer(data_path("hexapod.ipnct"), MeshBuffer::Compact);
 });
 
 Load< Scene > hexapod_scene(LoadTagDefault, []() -> Scene const * {
 	return new Scene(data_path("hexapod.scene"), [&](Scene &scene, Scene::Transform *transform, std::string const &mesh_name){
-		Mesh const &mesh = hexapod_meshes->lookup(mesh_name);
-
-		scene.drawables.emplace_back(transform);
-		Scene::Drawable &drawable = scene.drawables.back();
-
-		drawable.pipeline = lit_color_texture_program_pipeline;
-
-		drawable.pipeline.vao = hexapod_meshes_for_lit_color_texture_program;
-		drawable.pipeline.type = mesh.type;
-		drawable.pipeline.start = mesh.start;
-		drawable.pipeline.count = mesh.count;
+		make_lit_drawable(*hexapod_meshes, scene, transform, mesh_name);
 	});
 });
 
-GLuint blocks_meshes_for_lit_color_texture_program = 0;
 Load< MeshBuffer > blocks_meshes(LoadTagDefault, []() -> MeshBuffer const * {
-	MeshBuffer const *ret = new MeshBuffer(data_path("blocks.pnct"));
-	blocks_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program);
-	return ret;
+	return new MeshBuffer(data_path("blocks.ipnct"), MeshBuffer::Compact);
 });
 
-Load< Scene > blocks_scene(LoadTagDefault, []() -> Scene const * {
-	return new Scene(data_path("blocks.scene"), [&](Scene &scene, Scene::Transform *transform, std::string const &mesh_name){
-		Mesh const &mesh = blocks_meshes->lookup(mesh_name);
-
-		scene.drawables.emplace_back(transform);
-		Scene::Drawable &drawable = scene.drawables.back();
-
-		drawable.pipeline = lit_color_texture_program_pipeline;
+//makes drawables for the meshes in blocks.scene (used when loading it and when hot-reloading it):
+static void make_blocks_drawable(Scene &scene, Scene::Transform *transform, std::string const &mesh_name) {
+	make_lit_drawable(*blocks_meshes, scene, transform, mesh_name);
+}
 
-		drawable.pipeline.vao = blocks_meshes_for_lit_color_texture_program;
-		drawable.pipeline.type = mesh.type;
-		drawable.pipeline.start = mesh.start;
-		drawable.pipeline.count = mesh.count;
-	});
+Load< Scene > blocks_scene(LoadTagDefault, []() -> Scene const * {
+	return new Scene(data_path("blocks.scene"), make_blocks_drawable);
 });
 
 Load< Sound::Sample > alien_sample(LoadTagDefault, []() -> Sound::Sample const * {
@@ -98,17 +111,57 @@ PlayMode::PlayMode() : scene(*blocks_scene) {
 	}
 
 	//get transformation pointers for convenience:
-	for (auto &transform : scene.transforms) {
-		for (int i = 0; i < num_blocks; i++) {
-			if (transform.name == block_names[i]) blocks[i] = &transform;
-			if (transform.name == letter_names[i]) letters[i] = &transform;
-		}
+	for (int i = 0; i < num_blocks; i++) {
+		blocks[i] = scene.find_transform(block_names[i]);
+		if (blocks[i] == nullptr) throw std::runtime_error("Block '" + block_names[i] + "' not found.");
+		letters[i] = scene.find_transform(letter_names[i]);
+		if (letters[i] == nullptr) throw std::runtime_error("Letter '" + letter_names[i] + "' not found.");
 	}
 
 	//get pointer to camera for convenience:
 	if (scene.cameras.size() != 1) throw std::runtime_error("Expecting scene to have exactly one camera, but it has " + std::to_string(scene.cameras.size()));
 	camera = &scene.cameras.front();
 
+	//if the scene doesn't have any lights, add an overhead hemisphere light so that things are visible:
+	if (scene.lights.empty()) {
+		scene.transforms.emplace_back();
+		scene.transforms.back().name = "default light";
+		scene.lights.emplace_back(&scene.transforms.back());
+		Scene::Light &light = scene.lights.back();
+		light.type = Scene::Light::Hemisphere; //(shines along -z, i.e., down)
+		light.energy = glm::vec3(1.0f, 1.0f, 0.95f);
+	}
+
+	//drawables never change during play (only their transforms do), so build the draw list once:
+	// (hot reloading recompiles it if drawables change)
+	scene.compile();
+
+	//when blocks.scene or blocks.ipnct are re-exported, patch the changes into the running scene:
+	loaded_blocks = *blocks_scene;
+	auto reload_scene = [this](){
+		try {
+			Scene fresh(data_path("blocks.scene"), make_blocks_drawable);
+			Scene::PatchStats stats = scene.patch(loaded_blocks, fresh);
+			loaded_blocks = fresh;
+			std::cout << "Reloaded blocks.scene: changed " << stats.transforms << " transforms, "
+				<< stats.drawables << " drawables, " << stats.cameras << " cameras, " << stats.lights << " lights." << std::endl;
+		} catch (std::exception &e) {
+			std::cerr << "ERROR reloading blocks.scene: " << e.what() << std::endl;
+		}
+	};
+	watch.watch(data_path("blocks.scene"), reload_scene);
+	watch.watch(data_path("blocks.ipnct"), [reload_scene](){
+		try {
+			//(hot reloading is a development aid, so it is allowed to modify the loaded mesh buffer)
+			uint32_t uploaded = const_cast< MeshBuffer & >(*blocks_meshes).reload(data_path("blocks.ipnct"));
+			std::cout << "Reloaded blocks.ipnct: uploaded " << uploaded << " meshes." << std::endl;
+		} catch (std::exception &e) {
+			std::cerr << "ERROR reloading blocks.ipnct: " << e.what() << std::endl;
+			return;
+		}
+		reload_scene(); //(mesh ranges may have moved, so drawables need updating)
+	});
+
 	background_music = Sound::play(*background_sample);
 }
 
@@ -202,6 +255,9 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 }
 
 void PlayMode::update(float elapsed) {
+	//pick up re-exported assets:
+	watch.poll();
+
 	speed += elapsed * 2.0f;
 	remaining_time -= elapsed;
 	std::cout << remaining_time << std::endl;
@@ -228,13 +284,7 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 	//update camera aspect ratio for drawable:
 	camera->aspect = float(drawable_size.x) / float(drawable_size.y);
 
-	//set up light type and position for lit_color_texture_program:
-	// TODO: consider using the Light(s) in the scene to do this
-	glUseProgram(lit_color_texture_program->program);
-	glUniform1i(lit_color_texture_program->LIGHT_TYPE_int, 1);
-	glUniform3fv(lit_color_texture_program->LIGHT_DIRECTION_vec3, 1, glm::value_ptr(glm::vec3(0.0f, 0.0f,-1.0f)));
-	glUniform3fv(lit_color_texture_program->LIGHT_ENERGY_vec3, 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 0.95f)));
-	glUseProgram(0);
+	//(lights for lit_color_texture_program come from the scene's lights; see Scene::draw)
 
 	glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
 	glClearDepth(1.0f); //1.0 is actually the default value to clear the depth buffer to, but FYI you can change it.
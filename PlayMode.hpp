@@ -2,6 +2,7 @@
 
 #include "Scene.hpp"
 #include "Sound.hpp"
+#include "FileWatch.hpp"
 
 #include <glm/glm.hpp>
 
@@ -25,6 +26,10 @@ struct PlayMode : Mode {
 	//local copy of the game scene (so code can change it during gameplay):
 	Scene scene;
 
+	//hot reloading (changes to blocks.scene and blocks.ipnct are patched into 'scene'):
+	FileWatch watch;
+	Scene loaded_blocks; //blocks.scene as last loaded (changes are found by comparing a fresh load to this)
+
 	const static int num_blocks = 16;
 	const static int num_pairs = num_blocks / 2;
 	bool first_pressed = false;
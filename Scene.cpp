@@ -1,11 +1,23 @@
 #include "Scene.hpp"
 
+#include "ColorProgram.hpp"
+#include "Jobs.hpp"
+#include "MappedFile.hpp"
 #include "gl_errors.hpp"
 #include "read_write_chunk.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
-#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <istream>
+#include <iterator>
+#include <map>
+#include <streambuf>
+#include <type_traits>
+#include <unordered_set>
 
 //-------------------------
 
@@ -71,6 +83,71 @@ glm::mat4x3 Scene::Transform::make_world_to_local() const {
 	}
 }
 
+//bring world_cache up to date:
+static Scene::Transform::WorldCache const &update_world_cache(Scene::Transform const &transform) {
+	//make sure the parent's cache is current first (this also gives it a fresh version number if it changed):
+	uint32_t parent_version = 0;
+	if (transform.parent) {
+		parent_version = update_world_cache(*transform.parent).version;
+	}
+
+	Scene::Transform::WorldCache &cache = transform.world_cache;
+	if (cache.version == 0
+	 || cache.position != transform.position || cache.rotation != transform.rotation || cache.scale != transform.scale
+	 || cache.parent != transform.parent || cache.parent_version != parent_version) {
+		cache.position = transform.position;
+		cache.rotation = transform.rotation;
+		cache.scale = transform.scale;
+		cache.parent = transform.parent;
+		cache.parent_version = parent_version;
+
+		//same as make_local_to_parent(), but keeping the rotation around for the normal matrix:
+		glm::mat3 rot = glm::mat3_cast(transform.rotation);
+		glm::vec3 const &scale = transform.scale;
+		glm::mat4x3 local_to_parent = glm::mat4x3(
+			rot[0] * scale.x,
+			rot[1] * scale.y,
+			rot[2] * scale.z,
+			transform.position
+		);
+
+		//the inverse transpose of (rotate * scale) is (rotate * 1/scale), so no general 3x3 inverse is needed:
+		// (as in make_parent_to_local, zero scales give a degenerate matrix rather than NaN's)
+		glm::mat3 normal_to_parent;
+		if (scale.x == scale.y && scale.y == scale.z) {
+			//uniform scale (including rigid transforms): just a scaled rotation
+			if (scale.x == 1.0f) normal_to_parent = rot;
+			else normal_to_parent = rot * (scale.x == 0.0f ? 0.0f : 1.0f / scale.x);
+		} else {
+			normal_to_parent = glm::mat3(
+				rot[0] * (scale.x == 0.0f ? 0.0f : 1.0f / scale.x),
+				rot[1] * (scale.y == 0.0f ? 0.0f : 1.0f / scale.y),
+				rot[2] * (scale.z == 0.0f ? 0.0f : 1.0f / scale.z)
+			);
+		}
+
+		if (transform.parent) {
+			Scene::Transform::WorldCache const &parent_cache = transform.parent->world_cache;
+			cache.local_to_world = parent_cache.local_to_world * glm::mat4(local_to_parent);
+			cache.normal_to_world = parent_cache.normal_to_world * normal_to_parent;
+		} else {
+			cache.local_to_world = local_to_parent;
+			cache.normal_to_world = normal_to_parent;
+		}
+		cache.version += 1;
+		if (cache.version == 0) cache.version = 1; //(0 is reserved for "never computed")
+	}
+	return cache;
+}
+
+glm::mat4x3 const &Scene::Transform::cached_local_to_world() const {
+	return update_world_cache(*this).local_to_world;
+}
+
+glm::mat3 const &Scene::Transform::cached_normal_to_world() const {
+	return update_world_cache(*this).normal_to_world;
+}
+
 //-------------------------
 
 glm::mat4 Scene::Camera::make_projection() const {
@@ -87,9 +164,77 @@ void Scene::draw(Camera const &camera) const {
 	draw(world_to_clip, world_to_light);
 }
 
-void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+//Drawables are sent to OpenGL in order of a sort key that groups drawables that share state:
+// [63..52] program | [51..40] vertex array | [39..24] textures | [23..0] depth (front-to-back)
+// (names are folded into a few bits; collisions only cost a few extra state changes, since the state cache in draw() compares actual values)
+// drawables that can be instanced (or multi-drawn) use their vertex range instead of depth, so that copies of the same mesh end up adjacent.
+static uint64_t make_state_key(Scene::Drawable::Pipeline const &pipeline) {
+	uint64_t textures = 0;
+	for (uint32_t i = 0; i < Scene::Drawable::Pipeline::TextureCount; ++i) {
+		textures = (textures * 31) + pipeline.textures[i].texture;
+	}
+	textures = (textures ^ (textures >> 16) ^ (textures >> 32) ^ (textures >> 48)) & 0xffff;
+
+	uint64_t key = (uint64_t(pipeline.program & 0xfff) << 52)
+	             | (uint64_t(pipeline.vao & 0xfff) << 40)
+	             | (textures << 24);
+	if (pipeline.instanced.program != 0 || pipeline.multi_draw.program != 0) {
+		key |= uint64_t(pipeline.start & 0xffffff);
+	}
+	return key;
+}
+
+// (drawables that can be instanced or multi-drawn use the vertex range actually drawn, which depends on level of detail)
+static uint64_t make_sort_key(Scene::DrawList::Command const &command, float depth, GLuint start) {
+	if (command.instanced.program != 0 || command.multi_draw.program != 0) return (command.state_key & ~uint64_t(0xffffff)) | uint64_t(start & 0xffffff);
+	if (!(depth > 0.0f)) return command.state_key;
+	//non-negative IEEE floats sort in the same order as their bit patterns:
+	uint32_t depth_bits = 0;
+	static_assert(sizeof(depth_bits) == sizeof(depth), "float is 32 bits");
+	std::memcpy(&depth_bits, &depth, sizeof(depth));
+	return command.state_key | uint64_t(depth_bits >> 8);
+}
+
+//can these commands be drawn with one instanced draw call?
+// (the caller also checks that they draw the same vertex range, since that depends on level of detail)
+static bool can_instance_together(Scene::DrawList::Command const &a, Scene::DrawList::Command const &b) {
+	if (a.instanced.program == 0 || a.instanced.vao == 0) return false;
+	if (a.set_uniforms != -1U || b.set_uniforms != -1U) return false;
+	if (a.program != b.program || a.vao != b.vao) return false;
+	if (a.type != b.type) return false;
+	if (a.instanced.program != b.instanced.program || a.instanced.vao != b.instanced.vao) return false;
+	for (uint32_t i = 0; i < Scene::Drawable::Pipeline::TextureCount; ++i) {
+		if (a.textures[i].texture != b.textures[i].texture) return false;
+		if (a.textures[i].texture != 0 && a.textures[i].target != b.textures[i].target) return false;
+	}
+	return true;
+}
+
+//can these commands be drawn with one multi-draw call?
+// (the caller also checks that they draw disjoint, known vertex ranges, since each vertex holds the index of the drawable using it)
+static bool can_multi_draw_together(Scene::DrawList::Command const &a, Scene::DrawList::Command const &b) {
+	if (a.multi_draw.program == 0 || a.multi_draw.vao == 0) return false;
+	if (a.set_uniforms != -1U || b.set_uniforms != -1U) return false;
+	if (a.program != b.program || a.vao != b.vao) return false;
+	if (a.type != b.type || a.index_type != b.index_type) return false;
+	if (a.multi_draw.program != b.multi_draw.program || a.multi_draw.vao != b.multi_draw.vao) return false;
+	for (uint32_t i = 0; i < Scene::Drawable::Pipeline::TextureCount; ++i) {
+		if (a.textures[i].texture != b.textures[i].texture) return false;
+		if (a.textures[i].texture != 0 && a.textures[i].target != b.textures[i].target) return false;
+	}
+	return true;
+}
+
+static_assert(std::is_trivially_copyable< Scene::DrawList::Command >::value, "draw commands are plain data.");
+
+//fill in a DrawList from a list of drawables:
+static void build_draw_list(StableVector< Scene::Drawable > const &drawables, Scene::DrawList *list_) {
+	assert(list_);
+	Scene::DrawList &list = *list_;
+
+	list.commands.clear();
+	list.set_uniforms.clear();
 
-	//Iterate through all drawables, sending each one to OpenGL:
 	for (auto const &drawable : drawables) {
 		//Reference to drawable's pipeline for convenience:
 		Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
@@ -101,63 +246,1028 @@ void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_lig
 		//skip any drawables that don't contain any vertices:
 		if (pipeline.count == 0) continue;
 
+		assert(drawable.transform); //drawables *must* have a transform
+
+		list.commands.emplace_back();
+		Scene::DrawList::Command &command = list.commands.back();
+		command.state_key = make_state_key(pipeline);
+		command.drawable = &drawable;
+		command.transform = drawable.transform;
+		command.program = pipeline.program;
+		command.vao = pipeline.vao;
+		command.type = pipeline.type;
+		command.start = pipeline.start;
+		command.count = pipeline.count;
+		command.index_type = pipeline.index_type;
+		command.base_vertex = pipeline.base_vertex;
+		command.vertex_count = pipeline.vertex_count;
+		command.position_scale = pipeline.position_scale;
+		command.position_offset = pipeline.position_offset;
+		command.OBJECT_TO_CLIP_mat4 = pipeline.OBJECT_TO_CLIP_mat4;
+		command.OBJECT_TO_LIGHT_mat4x3 = pipeline.OBJECT_TO_LIGHT_mat4x3;
+		command.NORMAL_TO_LIGHT_mat3 = pipeline.NORMAL_TO_LIGHT_mat3;
+		command.OBJECT_block = pipeline.OBJECT_block;
+		command.bounds_min = drawable.bounds_min;
+		command.bounds_max = drawable.bounds_max;
+		if (*pipeline.set_uniforms) {
+			command.set_uniforms = uint32_t(list.set_uniforms.size());
+			list.set_uniforms.emplace_back(&*pipeline.set_uniforms);
+		}
+		for (uint32_t i = 0; i < Scene::Drawable::Pipeline::TextureCount; ++i) {
+			command.textures[i] = pipeline.textures[i];
+		}
+		command.instanced = pipeline.instanced;
+		command.multi_draw = pipeline.multi_draw;
+	}
 
-		//Set shader program:
-		glUseProgram(pipeline.program);
+	//pre-sort by state, so the per-frame sort mostly has to reorder by depth:
+	std::stable_sort(list.commands.begin(), list.commands.end(), [](Scene::DrawList::Command const &a, Scene::DrawList::Command const &b) {
+		return a.state_key < b.state_key;
+	});
 
-		//Set attribute sources:
-		glBindVertexArray(pipeline.vao);
+	list.drawable_count = drawables.size();
+	list.compiled = true;
+}
 
-		//Configure program uniforms:
+void Scene::compile() {
+	build_draw_list(drawables, &draw_list);
+}
 
-		//the object-to-world matrix is used in all three of these uniforms:
-		assert(drawable.transform); //drawables *must* have a transform
-		glm::mat4x3 object_to_world = drawable.transform->make_local_to_world();
+//scratch storage for draw(), kept between calls to avoid per-frame allocation:
+static Scene::DrawList temporary_draw_list; //used when a scene doesn't have a current draw_list
+
+struct DrawItem {
+	uint64_t key;
+	uint32_t command; //index into draw list's commands
+	GLuint start, count; //vertex (or index) range to draw (the command's, or that of a coarser level of detail)
+	GLint base_vertex; //(indexed drawing)
+	GLuint vertex_count; //(indexed drawing) vertices used, starting at base_vertex
+	uint32_t lod; //level of detail drawn (0 = the command's own range, i = drawable's lods[i-1])
+};
+static std::vector< DrawItem > draw_queue;
+
+//matrix taking an item's vertices (as the program reads them) to world space:
+// (the same as object_to_world, unless the item's mesh has quantized positions, whose decoding is folded in)
+static glm::mat4x3 vertex_to_world(Scene::DrawList::Command const &command, DrawItem const &item, glm::mat4x3 const &object_to_world) {
+	glm::vec3 scale = command.position_scale;
+	glm::vec3 offset = command.position_offset;
+	if (item.lod > 0) {
+		std::vector< Scene::Drawable::LOD > const &lods = command.drawable->lods;
+		scale = lods[item.lod - 1].position_scale;
+		offset = lods[item.lod - 1].position_offset;
+	}
+	if (scale == glm::vec3(1.0f) && offset == glm::vec3(0.0f)) return object_to_world;
+	return glm::mat4x3(
+		object_to_world[0] * scale.x,
+		object_to_world[1] * scale.y,
+		object_to_world[2] * scale.z,
+		object_to_world * glm::vec4(offset, 1.0f)
+	);
+}
 
-		//OBJECT_TO_CLIP takes vertices from object space to clip space:
-		if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
-			glm::mat4 object_to_clip = world_to_clip * glm::mat4(object_to_world);
-			glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
+//issue the draw call for a queued item (indexed or not, with 'instances' copies):
+static void draw_range(Scene::DrawList::Command const &command, DrawItem const &item, GLsizei instances) {
+	if (command.index_type != GL_NONE) {
+		GLsizeiptr index_size = (command.index_type == GL_UNSIGNED_SHORT ? 2 : (command.index_type == GL_UNSIGNED_BYTE ? 1 : 4));
+		void const *offset = (GLbyte *)0 + item.start * index_size;
+		if (instances == 1) glDrawElementsBaseVertex(command.type, GLsizei(item.count), command.index_type, offset, item.base_vertex);
+		else glDrawElementsInstancedBaseVertex(command.type, GLsizei(item.count), command.index_type, offset, instances, item.base_vertex);
+	} else {
+		if (instances == 1) glDrawArrays(command.type, GLint(item.start), GLsizei(item.count));
+		else glDrawArraysInstanced(command.type, GLint(item.start), GLsizei(item.count), instances);
+	}
+}
+
+//draw() spreads its CPU work over Jobs::shared(); each worker collects results here, which are merged afterward:
+static std::vector< std::vector< DrawItem > > worker_queues;
+struct WorkerStats {
+	uint32_t lowered = 0;
+	uint32_t object_lights = 0;
+};
+static std::vector< WorkerStats > worker_stats;
+
+//runs of draw_queue that are sent with one draw call:
+struct DrawBatch {
+	uint32_t begin, end; //range in draw_queue
+	uint32_t instance_begin; //first entry in instance_data, or -1U if this batch isn't instanced
+	uint32_t draw_begin; //first entry in draw_matrices, or -1U if this batch isn't a multi-draw
+	uint32_t object_block; //index of this batch's Scene::ObjectBlock in this draw's range of the object ring, or -1U if none
+	uint32_t draw_layer; //(multi-draw) layer of the vertex array's draw id stream that holds this batch's ids
+};
+static std::vector< DrawBatch > draw_batches;
+
+//per-instance attributes, as read by instanced pipelines:
+struct InstanceData {
+	glm::mat4x3 object_to_world;
+	glm::mat3 normal_to_world;
+};
+static_assert(sizeof(InstanceData) == 4*3*4 + 4*3*3, "InstanceData is packed.");
+static std::vector< InstanceData > instance_data;
+static GLuint instance_buffer = 0; //created on first use
+
+//per-drawable matrices, as read (via buffer texture) by multi-draw pipelines:
+struct DrawMatrices {
+	glm::vec4 object_to_world[3]; //rows
+	glm::vec4 normal_to_world[3]; //columns (w unused)
+};
+static_assert(sizeof(DrawMatrices) == 6*4*4, "DrawMatrices is six RGBA32F texels.");
+static std::vector< DrawMatrices > draw_matrices;
+static GLuint draw_matrices_buffer = 0; //created on first use
+static GLuint draw_matrices_texture = 0; //buffer texture viewing draw_matrices_buffer
+
+//multi-draw batches read the index of their drawables from a per-vertex attribute:
+// each multi-draw vertex array gets buffers ("layers") holding a draw id for every vertex of its arena.
+// Ids are tracked per vertex range (i.e., per mesh), so a batch whose meshes already hold the right ids costs
+// one lookup per mesh and uploads nothing; ids are only rewritten (and re-uploaded) for ranges whose id changes.
+// A range holds one id per layer per frame, so each further use of a mesh in the same frame goes in a batch
+// in a further layer (up to MaxDrawIDLayers; uses past that are drawn singly).
+struct DrawIDLayer {
+	GLuint buffer = 0;
+	GLsizeiptr size = 0; //size of buffer (in ids)
+	std::vector< uint32_t > ids; //copy of the buffer's contents
+	struct Range {
+		GLuint end;
+		uint32_t id; //id held by every vertex of the range (-1U if not written yet)
+		uint32_t frame; //draw_id_frame when the range was last claimed
+	};
+	std::map< GLuint, Range > ranges; //ranges seen so far, by first vertex (they never overlap)
+	uint32_t dirty_begin = -1U, dirty_end = 0; //range of ids changed since the last upload
+};
+struct DrawIDStream {
+	std::vector< DrawIDLayer > layers;
+	uint32_t attached = -1U; //layer currently attached to the vertex array at DrawIDLocation
+};
+enum : uint32_t { MaxDrawIDLayers = 4 };
+static std::unordered_map< GLuint, DrawIDStream > draw_id_streams; //multi-draw vertex array -> stream
+static uint32_t draw_id_frame = 0; //incremented by every draw()
+
+//ranges claimed by the batch being built (with their previous claim frames, so a batch that doesn't form can give them back):
+struct DrawIDClaim {
+	std::map< GLuint, DrawIDLayer::Range >::iterator range;
+	uint32_t previous_frame;
+};
+static std::vector< DrawIDClaim > draw_id_claims;
+
+//claim vertices [begin,end) of a layer for the batch being built, unless some of them were already claimed this frame:
+static bool claim_draw_ids(DrawIDLayer &layer, GLuint begin, GLuint end) {
+	auto &ranges = layer.ranges;
+	auto r = ranges.find(begin);
+	if (r == ranges.end() || r->second.end != end) {
+		//a range not seen before replaces the (older) ranges it overlaps:
+		auto o = ranges.lower_bound(begin);
+		if (o != ranges.begin() && std::prev(o)->second.end > begin) --o;
+		for (auto i = o; i != ranges.end() && i->first < end; ++i) {
+			if (i->second.frame == draw_id_frame) return false;
 		}
+		while (o != ranges.end() && o->first < end) o = ranges.erase(o);
+		r = ranges.emplace(begin, DrawIDLayer::Range{end, -1U, 0}).first;
+	}
+	if (r->second.frame == draw_id_frame) return false;
+	draw_id_claims.emplace_back(DrawIDClaim{r, r->second.frame});
+	r->second.frame = draw_id_frame;
+	return true;
+}
 
-		//the object-to-light matrix is used in the next two uniforms:
-		glm::mat4x3 object_to_light = world_to_light * glm::mat4(object_to_world);
+//give back the claims of a batch that didn't form:
+static void release_draw_ids() {
+	for (auto const &claim : draw_id_claims) {
+		claim.range->second.frame = claim.previous_frame;
+	}
+	draw_id_claims.clear();
+}
+
+//number the claims of a batch that did form from zero, rewriting ids only where they changed:
+static void write_draw_ids(DrawIDLayer &layer) {
+	for (uint32_t i = 0; i < draw_id_claims.size(); ++i) {
+		auto &[begin, range] = *draw_id_claims[i].range;
+		if (range.id == i) continue;
+		range.id = i;
+		if (layer.ids.size() < range.end) layer.ids.resize(range.end, -1U);
+		std::fill(layer.ids.begin() + begin, layer.ids.begin() + range.end, i);
+		layer.dirty_begin = std::min(layer.dirty_begin, begin);
+		layer.dirty_end = std::max(layer.dirty_end, range.end);
+	}
+	draw_id_claims.clear();
+}
 
-		//OBJECT_TO_CLIP takes vertices from object space to light space:
-		if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
-			glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
+//scratch arrays for glMultiDraw* calls:
+static std::vector< GLint > multi_firsts;
+static std::vector< GLsizei > multi_counts;
+static std::vector< void const * > multi_offsets;
+static std::vector< GLint > multi_base_vertices;
+
+//range of vertices used by a queued item:
+static void item_vertices(Scene::DrawList::Command const &command, DrawItem const &item, GLuint *begin, GLuint *end) {
+	if (command.index_type != GL_NONE) {
+		*begin = GLuint(item.base_vertex);
+		*end = GLuint(item.base_vertex) + item.vertex_count;
+	} else {
+		*begin = item.start;
+		*end = item.start + item.count;
+	}
+}
+
+//Per-object uniform blocks are written into a ring buffer:
+// each draw() appends its blocks after those of the previous draw(), so writes never touch memory that
+// already-queued draw calls may be reading, and can use unsynchronized mappings.
+// When the ring runs out of room, its storage is orphaned (the driver keeps the old storage alive until the GPU is done with it).
+static struct {
+	GLuint buffer = 0; //created on first use
+	GLsizeiptr size = 0; //size of buffer
+	GLsizeiptr head = 0; //next free byte
+	GLsizeiptr stride = 0; //sizeof(ObjectBlock) rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+} object_ring;
+
+//map space for 'count' object blocks in the ring; returns offset of the range in the ring buffer:
+// (leaves the ring buffer bound to GL_UNIFORM_BUFFER)
+static GLintptr map_object_blocks(uint32_t count, Scene::ObjectBlock **mapped) {
+	assert(mapped);
+	if (object_ring.buffer == 0) {
+		glGenBuffers(1, &object_ring.buffer);
+		GLint alignment = 0;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		alignment = std::max(alignment, GLint(1));
+		object_ring.stride = (sizeof(Scene::ObjectBlock) + alignment - 1) / alignment * alignment;
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, object_ring.buffer);
+
+	GLsizeiptr bytes = count * object_ring.stride;
+	if (object_ring.head + bytes > object_ring.size) {
+		//out of room: orphan the current storage (growing it if needed) and start again from the beginning:
+		object_ring.size = std::max(object_ring.size, GLsizeiptr(64 * 1024));
+		while (object_ring.size < bytes) object_ring.size *= 2;
+		glBufferData(GL_UNIFORM_BUFFER, object_ring.size, nullptr, GL_STREAM_DRAW);
+		object_ring.head = 0;
+	}
+
+	GLintptr offset = object_ring.head;
+	object_ring.head += bytes;
+	*mapped = reinterpret_cast< Scene::ObjectBlock * >(glMapBufferRange(GL_UNIFORM_BUFFER, offset, bytes,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+	return offset;
+}
+
+//All lights are packed into one uniform block per draw():
+static Scene::LightsBlock lights_block;
+static GLuint lights_buffer = 0; //created on first use
+
+//world-space extent of each packed light, used to find the lights that reach each drawable:
+struct LightReach {
+	glm::vec3 position;
+	float range; //< 0 => reaches everything
+};
+static std::vector< LightReach > light_reach;
+
+//fill in the indices of lights that reach the (object-space) box [min,max] under 'object_to_world':
+static uint32_t find_object_lights(glm::vec3 const &min, glm::vec3 const &max, glm::mat4x3 const &object_to_world, glm::ivec4 *indices) {
+	bool unbounded = !(min.x <= max.x && min.y <= max.y && min.z <= max.z);
+
+	//world-space bounding box of the object's bounding box:
+	glm::vec3 center = object_to_world * glm::vec4(0.5f * (min + max), 1.0f);
+	glm::vec3 radius = 0.5f * (max - min);
+	glm::vec3 extent = glm::vec3(0.0f);
+	if (!unbounded) {
+		for (uint32_t c = 0; c < 3; ++c) {
+			extent += glm::abs(glm::vec3(object_to_world[c])) * radius[c];
 		}
+	}
 
-		//NORMAL_TO_CLIP takes normals from object space to light space:
-		if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
-			glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(object_to_light)));
-			glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
+	uint32_t count = 0;
+	for (uint32_t l = 0; l < light_reach.size() && count < Scene::MaxObjectLights; ++l) {
+		LightReach const &reach = light_reach[l];
+		if (!unbounded && reach.range >= 0.0f) {
+			//distance from light to nearest point on box:
+			glm::vec3 offset = glm::max(glm::abs(reach.position - center) - extent, glm::vec3(0.0f));
+			if (glm::dot(offset, offset) > reach.range * reach.range) continue;
 		}
+		indices[count / 4][count % 4] = int32_t(l);
+		++count;
+	}
+	for (uint32_t i = count; i < Scene::MaxObjectLights; ++i) {
+		indices[i / 4][i % 4] = -1;
+	}
+	return count;
+}
 
-		//set any requested custom uniforms:
-		if (pipeline.set_uniforms) pipeline.set_uniforms();
+//---- occlusion culling ----
 
-		//set up textures:
+//query objects not currently in use by any scene:
+// (scenes return their queries here instead of deleting them, so that destroying a scene doesn't need a GL context;
+//  the pool is intentionally never freed, since it may outlive the context anyway)
+static std::vector< GLuint > &spare_queries() {
+	static std::vector< GLuint > *spare = new std::vector< GLuint >();
+	return *spare;
+}
+
+static GLuint get_query() {
+	std::vector< GLuint > &spare = spare_queries();
+	if (spare.empty()) {
+		spare.resize(64);
+		glGenQueries(GLsizei(spare.size()), spare.data());
+	}
+	GLuint query = spare.back();
+	spare.pop_back();
+	return query;
+}
+
+static void release_queries(std::unordered_map< Scene::Drawable const *, Scene::OcclusionQuery > *queries) {
+	for (auto const &dq : *queries) {
+		if (dq.second.query != 0) spare_queries().emplace_back(dq.second.query);
+	}
+	queries->clear();
+}
+
+//vertex array holding the 36 vertices of the [0,1]^3 cube, with positions at color_program->Position_vec4:
+static GLuint occlusion_box_vao() {
+	static GLuint vao = 0;
+	if (vao == 0) {
+		static glm::vec3 const corners[8] = {
+			{0,0,0}, {1,0,0}, {0,1,0}, {1,1,0},
+			{0,0,1}, {1,0,1}, {0,1,1}, {1,1,1},
+		};
+		static uint8_t const faces[6][4] = {
+			{0,2,3,1}, {4,5,7,6}, //-z, +z
+			{0,1,5,4}, {2,6,7,3}, //-y, +y
+			{0,4,6,2}, {1,3,7,5}, //-x, +x
+		};
+		std::vector< glm::vec3 > triangles;
+		for (auto const &f : faces) {
+			for (uint32_t i : {0, 1, 2, 0, 2, 3}) triangles.emplace_back(corners[f[i]]);
+		}
+
+		GLuint buffer = 0;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glBufferData(GL_ARRAY_BUFFER, triangles.size() * sizeof(glm::vec3), triangles.data(), GL_STATIC_DRAW);
+
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+		glVertexAttribPointer(color_program->Position_vec4, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLbyte *)0);
+		glEnableVertexAttribArray(color_program->Position_vec4);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		//(buffer and vertex array live as long as the program does)
+	}
+	return vao;
+}
+
+//commands whose bounding boxes get tested this frame:
+struct OcclusionTest {
+	uint32_t command;
+	Scene::OcclusionQuery *query; //(points into Scene::occlusion_queries; unordered_map elements don't move)
+};
+static std::vector< OcclusionTest > occlusion_tests;
+static std::vector< uint8_t > command_hidden; //per command: skipped because it was occluded? (empty if not culling)
+
+Scene::~Scene() {
+	release_queries(&occlusion_queries);
+}
+
+//---- level of detail ----
+
+//pick the level of detail for a drawable (with bounds), given its current level and its screen size under world_to_clip:
+// (clip_scale is world_to_clip's vertical scale -- see draw())
+static uint32_t select_lod(Scene::Drawable const &drawable, glm::mat4x3 const &object_to_world, glm::mat4 const &world_to_clip, float clip_scale, float hysteresis) {
+	std::vector< Scene::Drawable::LOD > const &lods = drawable.lods;
+
+	//world-space bounding sphere of the drawable (or of its bounding box, if it doesn't have one):
+	glm::vec3 center = object_to_world * glm::vec4(0.5f * (drawable.bounds_min + drawable.bounds_max), 1.0f);
+	float scale = std::max(glm::length(object_to_world[0]), std::max(glm::length(object_to_world[1]), glm::length(object_to_world[2])));
+	float radius = (drawable.bounds_radius > 0.0f ? drawable.bounds_radius : 0.5f * glm::length(drawable.bounds_max - drawable.bounds_min)) * scale;
+
+	//fraction of the viewport's height covered by the sphere (ignoring the stretching of things away from the center of view):
+	float w = (world_to_clip * glm::vec4(center, 1.0f)).w;
+	if (w <= radius) return 0; //camera is (nearly) inside the sphere
+	float size = radius * clip_scale / w;
+
+	uint32_t lod = std::min(drawable.lod, uint32_t(lods.size()));
+	while (lod < lods.size() && size < lods[lod].screen_size * (1.0f - hysteresis)) ++lod;
+	while (lod > 0 && size > lods[lod - 1].screen_size * (1.0f + hysteresis)) --lod;
+	return lod;
+}
+
+void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+	draw_stats = DrawStats();
+
+	//normals go to light space via (world_to_light's normal matrix) * (each transform's cached normal matrix):
+	// (light space is usually just world space, in which case the cached matrices can be used as-is)
+	bool light_is_world = (world_to_light == glm::mat4x3(1.0f));
+	glm::mat3 normal_world_to_light = glm::mat3(1.0f);
+	if (!light_is_world) normal_world_to_light = glm::inverse(glm::transpose(glm::mat3(world_to_light)));
+
+	//Use the compiled draw list if it is still current, otherwise build one just for this frame:
+	DrawList const *list = &draw_list;
+	if (!draw_list.compiled || draw_list.drawable_count != drawables.size()) {
+		build_draw_list(drawables, &temporary_draw_list);
+		list = &temporary_draw_list;
+	}
+	std::vector< DrawList::Command > const &commands = list->commands;
+
+	//world_to_clip is usually projection * (rigid) world_to_camera, so the length of its second row is the projection's vertical scale:
+	float clip_scale = glm::length(glm::vec3(world_to_clip[0][1], world_to_clip[1][1], world_to_clip[2][1]));
+
+	//Bring world matrices up to date first:
+	// (this happens here, on one thread, because updating a transform may update its parents, which drawables can share;
+	//  afterward, cached_local_to_world() and cached_normal_to_world() only read, so the jobs below can call them freely)
+	for (auto const &command : commands) {
+		command.transform->cached_local_to_world();
+	}
+
+	//Check on occlusion queries (also here, since this calls OpenGL):
+	occlusion_tests.clear();
+	command_hidden.clear();
+	if (occlusion_culling) {
+		command_hidden.assign(commands.size(), 0);
+		for (uint32_t i = 0; i < commands.size(); ++i) {
+			DrawList::Command const &command = commands[i];
+			if (!(command.bounds_min.x <= command.bounds_max.x)) continue;
+
+			OcclusionQuery &oq = occlusion_queries[command.drawable];
+			if (oq.pending) {
+				//(results from a previous frame are usually ready; if not, keep using the older result rather than waiting)
+				GLuint available = GL_FALSE;
+				glGetQueryObjectuiv(oq.query, GL_QUERY_RESULT_AVAILABLE, &available);
+				if (available) {
+					GLuint passed = GL_FALSE;
+					glGetQueryObjectuiv(oq.query, GL_QUERY_RESULT, &passed);
+					oq.visible = (passed != GL_FALSE);
+					oq.pending = false;
+				}
+			}
+			occlusion_tests.emplace_back(OcclusionTest{i, &oq});
+
+			//skip drawables whose bounding box was hidden when last tested:
+			if (!oq.visible) {
+				command_hidden[i] = 1;
+				draw_stats.occluded += 1;
+			}
+		}
+	}
+
+	Jobs &jobs = Jobs::shared();
+	worker_queues.resize(jobs.workers());
+	worker_stats.assign(jobs.workers(), WorkerStats());
+
+	//Build a queue of commands in the order they will be drawn:
+	// (each worker fills its own queue from ranges of commands; the queues are merged and sorted below)
+	for (auto &queue : worker_queues) queue.clear();
+	jobs.parallel_for(uint32_t(commands.size()), 256, [&](uint32_t begin, uint32_t end, uint32_t worker) {
+		std::vector< DrawItem > &queue = worker_queues[worker];
+		for (uint32_t i = begin; i < end; ++i) {
+			if (!command_hidden.empty() && command_hidden[i]) continue;
+			DrawList::Command const &command = commands[i];
+
+			glm::mat4x3 const &object_to_world = command.transform->cached_local_to_world();
+
+			//pick a level of detail:
+			GLuint start = command.start;
+			GLuint count = command.count;
+			GLint base_vertex = command.base_vertex;
+			GLuint vertex_count = command.vertex_count;
+			uint32_t lod = 0;
+			Drawable const &drawable = *command.drawable;
+			std::vector< Drawable::LOD > const &lods = drawable.lods;
+			if (!lods.empty() && command.bounds_min.x <= command.bounds_max.x) {
+				drawable.lod = select_lod(drawable, object_to_world, world_to_clip, clip_scale, lod_hysteresis);
+				lod = drawable.lod;
+				if (drawable.lod > 0) {
+					start = lods[drawable.lod - 1].start;
+					count = lods[drawable.lod - 1].count;
+					base_vertex = lods[drawable.lod - 1].base_vertex;
+					vertex_count = lods[drawable.lod - 1].vertex_count;
+					worker_stats[worker].lowered += 1;
+				}
+			}
+
+			//depth of the drawable's origin, used to order drawables front-to-back within a state group:
+			glm::vec3 origin = object_to_world[3];
+			float depth = (world_to_clip * glm::vec4(origin, 1.0f)).w;
+
+			queue.emplace_back(DrawItem{make_sort_key(command, depth, start), i, start, count, base_vertex, vertex_count, lod});
+		}
+	});
+
+	draw_queue.clear();
+	for (auto const &queue : worker_queues) {
+		draw_queue.insert(draw_queue.end(), queue.begin(), queue.end());
+	}
+
+	//(ties are broken by command index, so the order doesn't depend on how the work was split up)
+	std::sort(draw_queue.begin(), draw_queue.end(), [](DrawItem const &a, DrawItem const &b) {
+		if (a.key != b.key) return a.key < b.key;
+		return a.command < b.command;
+	});
+
+	//Split the queue into batches, laying out per-instance data for runs of identical pipelines:
+	draw_batches.clear();
+	draw_id_frame += 1;
+	uint32_t instance_count = 0;
+	uint32_t draw_count = 0;
+	uint32_t object_block_count = 0;
+	for (uint32_t begin = 0; begin < draw_queue.size(); /* later */) {
+		DrawItem const &item = draw_queue[begin];
+		DrawList::Command const &command = commands[item.command];
+		uint32_t end = begin + 1;
+		while (end < draw_queue.size()
+			&& draw_queue[end].start == item.start && draw_queue[end].count == item.count && draw_queue[end].base_vertex == item.base_vertex
+			&& can_instance_together(command, commands[draw_queue[end].command])) {
+			++end;
+		}
+
+		if (end - begin >= 2) {
+			draw_batches.emplace_back(DrawBatch{begin, end, instance_count, -1U, -1U, -1U});
+			instance_count += end - begin;
+			begin = end;
+			continue;
+		}
+
+		//a drawable that can't be instanced may still be multi-drawn with the (different) meshes after it:
+		// (stopping before any item that starts an instanced run; draw ids are numbered from zero as drawables join
+		//  the batch, and are only written once the batch has formed, so they only change when the batch does)
+		if (command.multi_draw.program != 0 && command.multi_draw.vao != 0 && (command.index_type == GL_NONE || item.vertex_count != 0)) {
+			GLuint vertices_begin, vertices_end;
+			item_vertices(command, item, &vertices_begin, &vertices_end);
+			DrawIDStream &stream = draw_id_streams[command.multi_draw.vao];
+			//the batch goes in the first layer where the first mesh's vertices haven't been claimed yet this frame:
+			uint32_t layer = 0;
+			while (layer < stream.layers.size() && !claim_draw_ids(stream.layers[layer], vertices_begin, vertices_end)) ++layer;
+			if (layer == stream.layers.size() && layer < MaxDrawIDLayers) {
+				stream.layers.emplace_back();
+				claim_draw_ids(stream.layers[layer], vertices_begin, vertices_end);
+			}
+			if (layer < stream.layers.size()) {
+				DrawIDLayer &ids = stream.layers[layer];
+				while (end < draw_queue.size() && can_multi_draw_together(command, commands[draw_queue[end].command])) {
+					DrawItem const &next = draw_queue[end];
+					if (end + 1 < draw_queue.size()
+						&& draw_queue[end + 1].start == next.start && draw_queue[end + 1].count == next.count && draw_queue[end + 1].base_vertex == next.base_vertex
+						&& can_instance_together(commands[next.command], commands[draw_queue[end + 1].command])) break;
+					if (command.index_type != GL_NONE && next.vertex_count == 0) break; //(vertex range unknown)
+					item_vertices(commands[next.command], next, &vertices_begin, &vertices_end);
+					if (!claim_draw_ids(ids, vertices_begin, vertices_end)) break; //(mesh already used: it starts the next batch)
+					++end;
+				}
+				if (end - begin >= 2) {
+					write_draw_ids(ids);
+					draw_batches.emplace_back(DrawBatch{begin, end, -1U, draw_count, -1U, layer});
+					draw_count += end - begin;
+					begin = end;
+					continue;
+				}
+				release_draw_ids();
+			}
+		}
+
+		draw_batches.emplace_back(DrawBatch{begin, begin + 1, -1U, -1U, -1U, -1U});
+		if (command.OBJECT_block != -1U) {
+			draw_batches.back().object_block = object_block_count;
+			++object_block_count;
+		}
+		begin = begin + 1;
+	}
+
+	//Gather per-instance (and per-draw) data:
+	instance_data.resize(instance_count);
+	draw_matrices.resize(draw_count);
+	jobs.parallel_for(uint32_t(draw_batches.size()), 256, [&](uint32_t begin, uint32_t end, uint32_t) {
+		for (uint32_t b = begin; b < end; ++b) {
+			DrawBatch const &batch = draw_batches[b];
+			if (batch.instance_begin != -1U) {
+				for (uint32_t i = batch.begin; i < batch.end; ++i) {
+					DrawList::Command const &command = commands[draw_queue[i].command];
+					Transform const &transform = *command.transform;
+					instance_data[batch.instance_begin + (i - batch.begin)] = InstanceData{
+						vertex_to_world(command, draw_queue[i], transform.cached_local_to_world()),
+						transform.cached_normal_to_world()
+					};
+				}
+			} else if (batch.draw_begin != -1U) {
+				for (uint32_t i = batch.begin; i < batch.end; ++i) {
+					DrawList::Command const &command = commands[draw_queue[i].command];
+					Transform const &transform = *command.transform;
+					glm::mat4x3 object_to_world = vertex_to_world(command, draw_queue[i], transform.cached_local_to_world());
+					glm::mat3 const &normal_to_world = transform.cached_normal_to_world();
+					DrawMatrices &matrices = draw_matrices[batch.draw_begin + (i - batch.begin)];
+					for (uint32_t r = 0; r < 3; ++r) {
+						matrices.object_to_world[r] = glm::vec4(object_to_world[0][r], object_to_world[1][r], object_to_world[2][r], object_to_world[3][r]);
+						matrices.normal_to_world[r] = glm::vec4(normal_to_world[r], 0.0f);
+					}
+				}
+			}
+		}
+	});
+
+	//Pack lights (in light space, which is what lit shaders compute in):
+	{
+		light_reach.clear();
+		for (auto const &light : lights) {
+			if (light_reach.size() == MaxLights) break;
+			glm::mat4x3 const &light_to_world = light.transform->cached_local_to_world();
+			glm::vec3 position = light_to_world[3];
+			glm::vec3 direction = -glm::vec3(light_to_world[2]); //lights shine along their -z axis
+
+			LightsBlock::Entry &entry = lights_block.LIGHTS[light_reach.size()];
+			float type = 0.0f;
+			if (light.type == Light::Point) type = 0.0f;
+			else if (light.type == Light::Hemisphere) type = 1.0f;
+			else if (light.type == Light::Spot) type = 2.0f;
+			else if (light.type == Light::Directional) type = 3.0f;
+			entry.POSITION = glm::vec4(world_to_light * glm::vec4(position, 1.0f), type);
+			entry.DIRECTION = glm::vec4(glm::normalize(normal_world_to_light * direction), std::cos(0.5f * light.spot_fov));
+			entry.ENERGY = glm::vec4(light.energy, light.distance);
+
+			bool limited = (light.type == Light::Point || light.type == Light::Spot) && light.distance > 0.0f;
+			light_reach.emplace_back(LightReach{position, limited ? light.distance : -1.0f});
+		}
+		lights_block.LIGHT_COUNT = glm::ivec4(int32_t(light_reach.size()), 0, 0, 0);
+		draw_stats.lights = uint32_t(light_reach.size());
+
+		if (lights_buffer == 0) glGenBuffers(1, &lights_buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, lights_buffer);
+		//(only the lights in use are uploaded; re-specifying the buffer means last frame's draws don't have to finish first)
+		GLsizeiptr bytes = offsetof(LightsBlock, LIGHTS) + light_reach.size() * sizeof(LightsBlock::Entry);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(LightsBlock), nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, bytes, &lights_block);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, LightsBlockBinding, lights_buffer);
+		draw_stats.blocks += 1;
+	}
+
+	//Upload all per-instance data for this draw at once:
+	if (!instance_data.empty()) {
+		if (instance_buffer == 0) glGenBuffers(1, &instance_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+		//(re-specifying the whole buffer lets the driver hand back fresh storage instead of waiting on last frame's draws)
+		glBufferData(GL_ARRAY_BUFFER, instance_data.size() * sizeof(InstanceData), instance_data.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	//...and all per-draw matrices for multi-draw batches:
+	if (!draw_matrices.empty()) {
+		if (draw_matrices_buffer == 0) {
+			glGenBuffers(1, &draw_matrices_buffer);
+			glGenTextures(1, &draw_matrices_texture);
+			glBindTexture(GL_TEXTURE_BUFFER, draw_matrices_texture);
+			glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, draw_matrices_buffer);
+			glBindTexture(GL_TEXTURE_BUFFER, 0);
+		}
+		glBindBuffer(GL_TEXTURE_BUFFER, draw_matrices_buffer);
+		glBufferData(GL_TEXTURE_BUFFER, draw_matrices.size() * sizeof(DrawMatrices), draw_matrices.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+
+	//...and any draw ids that changed:
+	for (auto &[vao, stream] : draw_id_streams) {
+		for (auto &layer : stream.layers) {
+			if (layer.dirty_begin >= layer.dirty_end) continue;
+			if (layer.buffer == 0) glGenBuffers(1, &layer.buffer);
+			glBindBuffer(GL_ARRAY_BUFFER, layer.buffer);
+			if (layer.size < GLsizeiptr(layer.ids.size())) {
+				//(grows to cover every vertex of the arena seen so far, so re-specifying is rare; the buffer keeps its name, so attachments stay valid)
+				layer.size = GLsizeiptr(layer.ids.size());
+				glBufferData(GL_ARRAY_BUFFER, layer.size * sizeof(uint32_t), layer.ids.data(), GL_DYNAMIC_DRAW);
+				draw_stats.draw_ids += uint32_t(layer.size);
+			} else {
+				glBufferSubData(GL_ARRAY_BUFFER, layer.dirty_begin * sizeof(uint32_t), (layer.dirty_end - layer.dirty_begin) * sizeof(uint32_t), layer.ids.data() + layer.dirty_begin);
+				draw_stats.draw_ids += layer.dirty_end - layer.dirty_begin;
+			}
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			layer.dirty_begin = -1U;
+			layer.dirty_end = 0;
+		}
+	}
+
+	//Compute and pack per-object matrices for all drawables that read them from a uniform block:
+	// (workers write straight into the mapped buffer; only this thread maps and unmaps it)
+	GLintptr object_blocks_offset = 0;
+	if (object_block_count > 0) {
+		Scene::ObjectBlock *blocks = nullptr;
+		object_blocks_offset = map_object_blocks(object_block_count, &blocks);
+		if (blocks) {
+			jobs.parallel_for(uint32_t(draw_batches.size()), 256, [&](uint32_t begin, uint32_t end, uint32_t worker) {
+				for (uint32_t b = begin; b < end; ++b) {
+					DrawBatch const &batch = draw_batches[b];
+					if (batch.object_block == -1U) continue;
+					DrawList::Command const &command = commands[draw_queue[batch.begin].command];
+					glm::mat4x3 const &object_to_world = command.transform->cached_local_to_world();
+					glm::mat4x3 vertices_to_world = vertex_to_world(command, draw_queue[batch.begin], object_to_world);
+					glm::mat4x3 object_to_light = world_to_light * glm::mat4(vertices_to_world);
+					glm::mat3 const &normal_to_world = command.transform->cached_normal_to_world();
+					glm::mat3 normal_to_light = (light_is_world ? normal_to_world : normal_world_to_light * normal_to_world);
+
+					Scene::ObjectBlock &block = *reinterpret_cast< Scene::ObjectBlock * >(
+						reinterpret_cast< char * >(blocks) + batch.object_block * object_ring.stride);
+					block.OBJECT_TO_CLIP = world_to_clip * glm::mat4(vertices_to_world);
+					for (uint32_t c = 0; c < 4; ++c) block.OBJECT_TO_LIGHT[c] = glm::vec4(object_to_light[c], 0.0f);
+					for (uint32_t c = 0; c < 3; ++c) block.NORMAL_TO_LIGHT[c] = glm::vec4(normal_to_light[c], 0.0f);
+					worker_stats[worker].object_lights += find_object_lights(command.bounds_min, command.bounds_max, object_to_world, block.LIGHT_INDICES);
+				}
+			});
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+		}
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	for (auto const &stats : worker_stats) {
+		draw_stats.lowered += stats.lowered;
+		draw_stats.object_lights += stats.object_lights;
+	}
+
+	//Track current OpenGL state so that only changes are sent:
+	// (assumes no program, vertex array, or textures are bound on entry)
+	GLuint current_program = 0;
+	GLuint current_vao = 0;
+	GLuint current_active_texture = 0;
+	Drawable::Pipeline::TextureInfo current_textures[Drawable::Pipeline::TextureCount];
+	bool multi_draw_matrices_bound = false; //draw_matrices_texture bound to MultiDrawMatricesUnit?
+
+	auto use_program = [&](GLuint program) {
+		if (current_program != program) {
+			glUseProgram(program);
+			current_program = program;
+			draw_stats.programs += 1;
+		}
+	};
+
+	auto bind_vao = [&](GLuint vao) {
+		if (current_vao != vao) {
+			glBindVertexArray(vao);
+			current_vao = vao;
+			draw_stats.vaos += 1;
+		}
+	};
+
+	auto set_active_texture = [&](uint32_t i) {
+		if (current_active_texture != i) {
+			glActiveTexture(GL_TEXTURE0 + i);
+			current_active_texture = i;
+			draw_stats.textures += 1;
+		}
+	};
+
+	//(units a command doesn't use are un-bound, as if each drawable started from a clean slate)
+	auto bind_textures = [&](DrawList::Command const &command) {
 		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, pipeline.textures[i].texture);
+			Drawable::Pipeline::TextureInfo const &want = command.textures[i];
+			Drawable::Pipeline::TextureInfo &have = current_textures[i];
+			if (want.texture == have.texture && (want.texture == 0 || want.target == have.target)) continue;
+			set_active_texture(i);
+			if (have.texture != 0 && have.target != want.target) {
+				glBindTexture(have.target, 0);
+				draw_stats.textures += 1;
+			}
+			if (want.texture != 0 || have.target == want.target) {
+				glBindTexture(want.target, want.texture);
+				draw_stats.textures += 1;
+			}
+			have = want;
+		}
+	};
+
+	//Send each batch to OpenGL:
+	for (auto const &batch : draw_batches) {
+		DrawItem const &item = draw_queue[batch.begin];
+		DrawList::Command const &command = commands[item.command];
+
+		if (batch.instance_begin != -1U) {
+			//----- instanced batch -----
+			use_program(command.instanced.program);
+			bind_vao(command.instanced.vao);
+
+			//point the instance attributes at this batch's part of the instance buffer:
+			glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+			GLbyte const *base = (GLbyte const *)0 + batch.instance_begin * sizeof(InstanceData);
+			for (GLuint c = 0; c < 4; ++c) {
+				GLuint location = Drawable::InstanceObjectToWorldLocation + c;
+				glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), base + offsetof(InstanceData, object_to_world) + c * sizeof(glm::vec3));
+				glVertexAttribDivisor(location, 1);
+				glEnableVertexAttribArray(location);
+			}
+			for (GLuint c = 0; c < 3; ++c) {
+				GLuint location = Drawable::InstanceNormalToWorldLocation + c;
+				glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), base + offsetof(InstanceData, normal_to_world) + c * sizeof(glm::vec3));
+				glVertexAttribDivisor(location, 1);
+				glEnableVertexAttribArray(location);
+			}
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+			//camera and light matrices are shared by all instances:
+			if (command.instanced.WORLD_TO_CLIP_mat4 != -1U) {
+				glUniformMatrix4fv(command.instanced.WORLD_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(world_to_clip));
+				draw_stats.uniforms += 1;
+			}
+			if (command.instanced.WORLD_TO_LIGHT_mat4x3 != -1U) {
+				glUniformMatrix4x3fv(command.instanced.WORLD_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(world_to_light));
+				draw_stats.uniforms += 1;
+			}
+			if (command.instanced.NORMAL_WORLD_TO_LIGHT_mat3 != -1U) {
+				glUniformMatrix3fv(command.instanced.NORMAL_WORLD_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_world_to_light));
+				draw_stats.uniforms += 1;
+			}
+
+			bind_textures(command);
+
+			draw_range(command, item, GLsizei(batch.end - batch.begin));
+			draw_stats.draws += 1;
+			draw_stats.vertices += item.count * (batch.end - batch.begin);
+			draw_stats.drawables += batch.end - batch.begin;
+			draw_stats.object_lights += (batch.end - batch.begin) * draw_stats.lights; //(instances are lit by every light)
+			continue;
+		}
+
+		if (batch.draw_begin != -1U) {
+			//----- multi-draw batch -----
+			use_program(command.multi_draw.program);
+			bind_vao(command.multi_draw.vao);
+
+			//attach the layer of draw ids that holds this batch's ids (if another is attached):
+			DrawIDStream &stream = draw_id_streams[command.multi_draw.vao];
+			if (stream.attached != batch.draw_layer) {
+				glBindBuffer(GL_ARRAY_BUFFER, stream.layers[batch.draw_layer].buffer);
+				glVertexAttribIPointer(Drawable::DrawIDLocation, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (GLbyte *)0);
+				glEnableVertexAttribArray(Drawable::DrawIDLocation);
+				glBindBuffer(GL_ARRAY_BUFFER, 0);
+				stream.attached = batch.draw_layer;
+			}
+
+			if (!multi_draw_matrices_bound) {
+				set_active_texture(Drawable::MultiDrawMatricesUnit);
+				glBindTexture(GL_TEXTURE_BUFFER, draw_matrices_texture);
+				draw_stats.textures += 1;
+				multi_draw_matrices_bound = true;
+			}
+
+			//camera and light matrices are shared by the batch; the batch's matrices start at draw_begin:
+			if (command.multi_draw.DRAW_BASE_int != -1U) {
+				glUniform1i(command.multi_draw.DRAW_BASE_int, GLint(batch.draw_begin));
+				draw_stats.uniforms += 1;
+			}
+			if (command.multi_draw.WORLD_TO_CLIP_mat4 != -1U) {
+				glUniformMatrix4fv(command.multi_draw.WORLD_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(world_to_clip));
+				draw_stats.uniforms += 1;
+			}
+			if (command.multi_draw.WORLD_TO_LIGHT_mat4x3 != -1U) {
+				glUniformMatrix4x3fv(command.multi_draw.WORLD_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(world_to_light));
+				draw_stats.uniforms += 1;
 			}
+			if (command.multi_draw.NORMAL_WORLD_TO_LIGHT_mat3 != -1U) {
+				glUniformMatrix3fv(command.multi_draw.NORMAL_WORLD_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_world_to_light));
+				draw_stats.uniforms += 1;
+			}
+
+			bind_textures(command);
+
+			multi_counts.clear();
+			for (uint32_t i = batch.begin; i < batch.end; ++i) {
+				multi_counts.emplace_back(GLsizei(draw_queue[i].count));
+				draw_stats.vertices += draw_queue[i].count;
+			}
+			if (command.index_type != GL_NONE) {
+				GLsizeiptr index_size = (command.index_type == GL_UNSIGNED_SHORT ? 2 : (command.index_type == GL_UNSIGNED_BYTE ? 1 : 4));
+				multi_offsets.clear();
+				multi_base_vertices.clear();
+				for (uint32_t i = batch.begin; i < batch.end; ++i) {
+					multi_offsets.emplace_back((GLbyte const *)0 + draw_queue[i].start * index_size);
+					multi_base_vertices.emplace_back(draw_queue[i].base_vertex);
+				}
+				glMultiDrawElementsBaseVertex(command.type, multi_counts.data(), command.index_type, multi_offsets.data(), GLsizei(multi_counts.size()), multi_base_vertices.data());
+			} else {
+				multi_firsts.clear();
+				for (uint32_t i = batch.begin; i < batch.end; ++i) {
+					multi_firsts.emplace_back(GLint(draw_queue[i].start));
+				}
+				glMultiDrawArrays(command.type, multi_firsts.data(), multi_counts.data(), GLsizei(multi_counts.size()));
+			}
+			draw_stats.draws += 1;
+			draw_stats.drawables += batch.end - batch.begin;
+			draw_stats.multi_drawn += batch.end - batch.begin;
+			draw_stats.object_lights += (batch.end - batch.begin) * draw_stats.lights; //(multi-drawn drawables are also lit by every light)
+			continue;
 		}
 
+		//----- single drawable -----
+
+		//Set shader program:
+		use_program(command.program);
+
+		//Set attribute sources:
+		bind_vao(command.vao);
+
+		//Configure program uniforms:
+
+		//if the program reads its matrices from a uniform block, they've already been packed above:
+		if (batch.object_block != -1U) {
+			glBindBufferRange(GL_UNIFORM_BUFFER, ObjectBlockBinding, object_ring.buffer,
+				object_blocks_offset + batch.object_block * object_ring.stride, sizeof(ObjectBlock));
+			draw_stats.blocks += 1;
+		}
+
+		//otherwise, matrices are sent as individual uniforms:
+		if (command.OBJECT_TO_CLIP_mat4 != -1U || command.OBJECT_TO_LIGHT_mat4x3 != -1U || command.NORMAL_TO_LIGHT_mat3 != -1U) {
+			//the object-to-world matrix is used in the first two of these uniforms:
+			// (with the decoding of quantized positions, if any, folded in -- normals don't need it)
+			glm::mat4x3 object_to_world = vertex_to_world(command, item, command.transform->cached_local_to_world());
+
+			//OBJECT_TO_CLIP takes vertices from object space to clip space:
+			if (command.OBJECT_TO_CLIP_mat4 != -1U) {
+				glm::mat4 object_to_clip = world_to_clip * glm::mat4(object_to_world);
+				glUniformMatrix4fv(command.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
+				draw_stats.uniforms += 1;
+			}
+
+			//the object-to-light matrix is used in the next two uniforms:
+			glm::mat4x3 object_to_light = world_to_light * glm::mat4(object_to_world);
+
+			//OBJECT_TO_CLIP takes vertices from object space to light space:
+			if (command.OBJECT_TO_LIGHT_mat4x3 != -1U) {
+				glUniformMatrix4x3fv(command.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
+				draw_stats.uniforms += 1;
+			}
+
+			//NORMAL_TO_CLIP takes normals from object space to light space:
+			if (command.NORMAL_TO_LIGHT_mat3 != -1U) {
+				glm::mat3 const &normal_to_world = command.transform->cached_normal_to_world();
+				glm::mat3 normal_to_light = (light_is_world ? normal_to_world : normal_world_to_light * normal_to_world);
+				glUniformMatrix3fv(command.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
+				draw_stats.uniforms += 1;
+			}
+		}
+
+		//set any requested custom uniforms:
+		if (command.set_uniforms != -1U) (*list->set_uniforms[command.set_uniforms])();
+
+		//set up textures:
+		bind_textures(command);
+
 		//draw the object:
-		glDrawArrays(pipeline.type, pipeline.start, pipeline.count);
+		draw_range(command, item, 1);
+		draw_stats.draws += 1;
+		draw_stats.drawables += 1;
+		draw_stats.vertices += item.count;
+	}
 
-		//un-bind textures:
-		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, 0);
+	//test bounding boxes against the depth buffer just drawn, for use next frame:
+	if (!occlusion_tests.empty()) {
+		//boxes are only tested against the depth buffer, never written to it (or to color):
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glDepthMask(GL_FALSE);
+
+		use_program(color_program->program);
+		bind_vao(occlusion_box_vao());
+		glVertexAttrib4f(color_program->Color_vec4, 1.0f, 1.0f, 1.0f, 1.0f); //(not an array, so uses this value)
+
+		for (OcclusionTest const &test : occlusion_tests) {
+			OcclusionQuery &oq = *test.query;
+			if (oq.pending) continue; //(still waiting on the previous query)
+
+			DrawList::Command const &command = commands[test.command];
+			glm::vec3 extent = command.bounds_max - command.bounds_min;
+			glm::mat4 box_to_object = glm::mat4(
+				glm::vec4(extent.x, 0.0f, 0.0f, 0.0f),
+				glm::vec4(0.0f, extent.y, 0.0f, 0.0f),
+				glm::vec4(0.0f, 0.0f, extent.z, 0.0f),
+				glm::vec4(command.bounds_min, 1.0f)
+			);
+			glm::mat4 box_to_clip = world_to_clip * glm::mat4(command.transform->cached_local_to_world()) * box_to_object;
+
+			//a box that reaches past the near plane would be clipped open, so don't trust its query (just call it visible):
+			bool crosses_near = false;
+			for (uint32_t c = 0; c < 8; ++c) {
+				glm::vec4 corner = box_to_clip * glm::vec4(float(c & 1), float((c >> 1) & 1), float((c >> 2) & 1), 1.0f);
+				if (corner.z < -corner.w) crosses_near = true;
+			}
+			if (crosses_near) {
+				oq.visible = true;
+				continue;
 			}
+
+			if (oq.query == 0) oq.query = get_query();
+			glUniformMatrix4fv(color_program->OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(box_to_clip));
+			glBeginQuery(GL_ANY_SAMPLES_PASSED, oq.query);
+			glDrawArrays(GL_TRIANGLES, 0, 36);
+			glEndQuery(GL_ANY_SAMPLES_PASSED);
+			oq.pending = true;
+			draw_stats.occlusion_queries += 1;
 		}
-		glActiveTexture(GL_TEXTURE0);
 
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glDepthMask(GL_TRUE);
+	}
+
+	//un-bind textures:
+	for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+		if (current_textures[i].texture != 0) {
+			set_active_texture(i);
+			glBindTexture(current_textures[i].target, 0);
+			draw_stats.textures += 1;
+		}
+	}
+	if (multi_draw_matrices_bound) {
+		set_active_texture(Drawable::MultiDrawMatricesUnit);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+		draw_stats.textures += 1;
 	}
+	set_active_texture(0);
 
 	glUseProgram(0);
 	glBindVertexArray(0);
@@ -166,13 +1276,25 @@ void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_lig
 }
 
 
+//read-only stream buffer over a block of memory (used to hand the unparsed part of a mapped file to load_extra):
+struct MemoryStreambuf : std::streambuf {
+	MemoryStreambuf(char const *begin, char const *end) {
+		//(streambuf wants non-const pointers, but get areas are never written through)
+		char *b = const_cast< char * >(begin);
+		setg(b, b, const_cast< char * >(end));
+	}
+};
+
 void Scene::load(std::string const &filename,
 	std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable) {
 
-	std::ifstream file(filename, std::ios::binary);
+	//the file is mapped rather than read, so chunks are checked (and entries read) in place:
+	MappedFile file(filename);
+	char const *at = file.data;
+	char const *end = file.data + file.size;
 
-	std::vector< char > names;
-	read_chunk(file, "str0", &names);
+	ChunkView< char > names_chunk = map_chunk< char >(&at, end, "str0");
+	std::string_view names(names_chunk.data, names_chunk.size());
 
 	struct HierarchyEntry {
 		uint32_t parent;
@@ -183,8 +1305,7 @@ void Scene::load(std::string const &filename,
 		glm::vec3 scale;
 	};
 	static_assert(sizeof(HierarchyEntry) == 4 + 4 + 4 + 4*3 + 4*4 + 4*3, "HierarchyEntry is packed.");
-	std::vector< HierarchyEntry > hierarchy;
-	read_chunk(file, "xfh0", &hierarchy);
+	ChunkView< HierarchyEntry > hierarchy = map_chunk< HierarchyEntry >(&at, end, "xfh0");
 
 	struct MeshEntry {
 		uint32_t transform;
@@ -192,8 +1313,7 @@ void Scene::load(std::string const &filename,
 		uint32_t name_end;
 	};
 	static_assert(sizeof(MeshEntry) == 4 + 4 + 4, "MeshEntry is packed.");
-	std::vector< MeshEntry > meshes;
-	read_chunk(file, "msh0", &meshes);
+	ChunkView< MeshEntry > meshes = map_chunk< MeshEntry >(&at, end, "msh0");
 
 	struct CameraEntry {
 		uint32_t transform;
@@ -202,8 +1322,7 @@ void Scene::load(std::string const &filename,
 		float clip_near, clip_far;
 	};
 	static_assert(sizeof(CameraEntry) == 4 + 4 + 4 + 4 + 4, "CameraEntry is packed.");
-	std::vector< CameraEntry > loaded_cameras;
-	read_chunk(file, "cam0", &loaded_cameras);
+	ChunkView< CameraEntry > loaded_cameras = map_chunk< CameraEntry >(&at, end, "cam0");
 
 	struct LightEntry {
 		uint32_t transform;
@@ -214,17 +1333,23 @@ void Scene::load(std::string const &filename,
 		float fov;
 	};
 	static_assert(sizeof(LightEntry) == 4 + 1 + 3 + 4 + 4 + 4, "LightEntry is packed.");
-	std::vector< LightEntry > loaded_lights;
-	read_chunk(file, "lmp0", &loaded_lights);
+	ChunkView< LightEntry > loaded_lights = map_chunk< LightEntry >(&at, end, "lmp0");
 
 
 	//--------------------------------
-	//Now that file is loaded, create transforms for hierarchy entries:
+	//Now that chunks are checked, create transforms for hierarchy entries:
 
 	std::vector< Transform * > hierarchy_transforms;
 	hierarchy_transforms.reserve(hierarchy.size());
 
-	for (auto const &h : hierarchy) {
+	//make room for everything up front so the containers each grow by at most one chunk:
+	transforms.reserve(transforms.size() + hierarchy.size());
+	drawables.reserve(drawables.size() + meshes.size());
+	cameras.reserve(cameras.size() + loaded_cameras.size());
+	lights.reserve(lights.size() + loaded_lights.size());
+
+	for (size_t i = 0; i < hierarchy.size(); ++i) {
+		HierarchyEntry h = hierarchy[i];
 		transforms.emplace_back();
 		Transform *t = &transforms.back();
 		if (h.parent != -1U) {
@@ -235,7 +1360,7 @@ void Scene::load(std::string const &filename,
 		}
 
 		if (h.name_begin <= h.name_end && h.name_end <= names.size()) {
-			t->name = std::string(names.begin() + h.name_begin, names.begin() + h.name_end);
+			t->name = names.substr(h.name_begin, h.name_end - h.name_begin);
 		} else {
 				throw std::runtime_error("scene file '" + filename + "' contains hierarchy entry with invalid name indices");
 		}
@@ -248,14 +1373,16 @@ void Scene::load(std::string const &filename,
 	}
 	assert(hierarchy_transforms.size() == hierarchy.size());
 
-	for (auto const &m : meshes) {
+	std::string name; //(reused, to avoid an allocation per mesh)
+	for (size_t i = 0; i < meshes.size(); ++i) {
+		MeshEntry m = meshes[i];
 		if (m.transform >= hierarchy_transforms.size()) {
 			throw std::runtime_error("scene file '" + filename + "' contains mesh entry with invalid transform index (" + std::to_string(m.transform) + ")");
 		}
 		if (!(m.name_begin <= m.name_end && m.name_end <= names.size())) {
 			throw std::runtime_error("scene file '" + filename + "' contains mesh entry with invalid name indices");
 		}
-		std::string name = std::string(names.begin() + m.name_begin, names.begin() + m.name_end);
+		name = names.substr(m.name_begin, m.name_end - m.name_begin);
 
 		if (on_drawable) {
 			on_drawable(*this, hierarchy_transforms[m.transform], name);
@@ -263,7 +1390,8 @@ void Scene::load(std::string const &filename,
 
 	}
 
-	for (auto const &c : loaded_cameras) {
+	for (size_t i = 0; i < loaded_cameras.size(); ++i) {
+		CameraEntry c = loaded_cameras[i];
 		if (c.transform >= hierarchy_transforms.size()) {
 			throw std::runtime_error("scene file '" + filename + "' contains camera entry with invalid transform index (" + std::to_string(c.transform) + ")");
 		}
@@ -278,7 +1406,8 @@ void Scene::load(std::string const &filename,
 		//N.b. far plane is ignored because cameras use infinite perspective matrices.
 	}
 
-	for (auto const &l : loaded_lights) {
+	for (size_t i = 0; i < loaded_lights.size(); ++i) {
+		LightEntry l = loaded_lights[i];
 		if (l.transform >= hierarchy_transforms.size()) {
 			throw std::runtime_error("scene file '" + filename + "' contains lamp entry with invalid transform index (" + std::to_string(l.transform) + ")");
 		}
@@ -299,12 +1428,18 @@ void Scene::load(std::string const &filename,
 		light->type = static_cast<Light::Type>(l.type);
 		light->energy = glm::vec3(l.color) / 255.0f * l.energy;
 		light->spot_fov = l.fov / 180.0f * 3.1415926f; //FOV is stored in degrees; convert to radians.
+		light->distance = l.distance;
 	}
 
-	//load any extra that a subclass wants:
-	load_extra(file, names, hierarchy_transforms);
+	//index transform names for find_transform():
+	rebuild_name_index();
+
+	//load any extra that a subclass wants (from a stream over the rest of the mapping):
+	MemoryStreambuf rest(at, end);
+	std::istream from(&rest);
+	load_extra(from, names, hierarchy_transforms);
 
-	if (file.peek() != EOF) {
+	if (from.peek() != EOF) {
 		std::cerr << "WARNING: trailing data in scene file '" << filename << "'" << std::endl;
 	}
 
@@ -314,6 +1449,111 @@ void Scene::load(std::string const &filename,
 
 //-------------------------
 
+//FNV-1a hash of a transform name, for the name index:
+static uint64_t hash_name(std::string_view name) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (char c : name) {
+		hash ^= uint8_t(c);
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+void Scene::rebuild_name_index() const {
+	//size the hash table to be at most half full:
+	size_t slots = 16;
+	while (slots < 2 * transforms.size()) slots *= 2;
+	name_index.by_name.assign(slots, nullptr);
+	name_index.sorted.clear();
+	name_index.sorted.reserve(transforms.size());
+
+	//n.b. transforms live in a StableVector and never move, so views of their names stay valid until they are renamed:
+	for (auto const &t : transforms) {
+		Transform *transform = const_cast< Transform * >(&t);
+		std::string_view name = *t.name;
+		for (size_t slot = hash_name(name) & (slots - 1); ; slot = (slot + 1) & (slots - 1)) {
+			Transform *&entry = name_index.by_name[slot];
+			if (entry == nullptr) {
+				entry = transform;
+				break;
+			}
+			if (*entry->name == name) break; //(keeps first transform with a given name)
+		}
+		name_index.sorted.emplace_back(name, transform);
+	}
+	std::stable_sort(name_index.sorted.begin(), name_index.sorted.end(), [](auto const &a, auto const &b) {
+		return a.first < b.first;
+	});
+
+	name_index.transform_count = transforms.size();
+	name_index.built = true;
+}
+
+Scene::Transform *Scene::find_transform(std::string_view name) {
+	return const_cast< Transform * >(static_cast< Scene const & >(*this).find_transform(name));
+}
+
+Scene::Transform const *Scene::find_transform(std::string_view name) const {
+	if (!name_index.built || name_index.transform_count != transforms.size()) rebuild_name_index();
+	std::vector< Transform * > const &by_name = name_index.by_name;
+	size_t mask = by_name.size() - 1;
+	for (size_t slot = hash_name(name) & mask; by_name[slot] != nullptr; slot = (slot + 1) & mask) {
+		if (*by_name[slot]->name == name) return by_name[slot];
+	}
+	return nullptr;
+}
+
+std::vector< Scene::Transform * > Scene::find_transforms_with_prefix(std::string_view prefix) {
+	if (!name_index.built || name_index.transform_count != transforms.size()) rebuild_name_index();
+
+	std::vector< Transform * > ret;
+	auto const &sorted = name_index.sorted;
+	auto f = std::lower_bound(sorted.begin(), sorted.end(), prefix, [](auto const &entry, std::string_view const &p) {
+		return entry.first < p;
+	});
+	while (f != sorted.end() && f->first.substr(0, prefix.size()) == prefix) {
+		ret.emplace_back(f->second);
+		++f;
+	}
+	return ret;
+}
+
+//does 'name' match 'pattern' ('*' matches any run of characters, '?' matches any one character)?
+static bool matches_wildcard(std::string_view name, std::string_view pattern) {
+	//greedy matching with backtracking to the most recent '*':
+	size_t n = 0, p = 0;
+	size_t star = std::string_view::npos, star_n = 0;
+	while (n < name.size()) {
+		if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+			++n; ++p;
+		} else if (p < pattern.size() && pattern[p] == '*') {
+			star = p++;
+			star_n = n;
+		} else if (star != std::string_view::npos) {
+			p = star + 1;
+			n = ++star_n;
+		} else {
+			return false;
+		}
+	}
+	while (p < pattern.size() && pattern[p] == '*') ++p;
+	return p == pattern.size();
+}
+
+std::vector< Scene::Transform * > Scene::find_transforms_matching(std::string_view pattern) {
+	//only names that start with the pattern's literal prefix can match:
+	std::string_view prefix = pattern.substr(0, pattern.find_first_of("*?"));
+	std::vector< Transform * > ret = find_transforms_with_prefix(prefix);
+	if (prefix.size() != pattern.size()) {
+		ret.erase(std::remove_if(ret.begin(), ret.end(), [&pattern](Transform const *t) {
+			return !matches_wildcard(*t->name, pattern);
+		}), ret.end());
+	}
+	return ret;
+}
+
+//-------------------------
+
 Scene::Scene(std::string const &filename, std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable) {
 	load(filename, on_drawable);
 }
@@ -328,17 +1568,24 @@ Scene &Scene::operator=(Scene const &other) {
 }
 
 void Scene::set(Scene const &other, std::unordered_map< Transform const *, Transform * > *transform_map_) {
+	if (&other == this) return;
+
+	//queries refer to this scene's old drawables:
+	release_queries(&occlusion_queries);
+	occlusion_culling = other.occlusion_culling;
+	lod_hysteresis = other.lod_hysteresis;
+
+	//transforms are copied in order, so a transform's index in other.transforms is also its index here:
+	auto remap = [&](Transform const *t) -> Transform * {
+		if (t == nullptr) return nullptr;
+		size_t index = other.transforms.index_of(t);
+		if (index == size_t(-1)) throw std::runtime_error("Scene::set: scene references a transform it doesn't contain.");
+		return &transforms[index];
+	};
 
-	std::unordered_map< Transform const *, Transform * > t2t_temp;
-	std::unordered_map< Transform const *, Transform * > &transform_to_transform = *(transform_map_ ? transform_map_ : &t2t_temp);
-
-	transform_to_transform.clear();
-
-	//null transform maps to itself:
-	transform_to_transform.insert(std::make_pair(nullptr, nullptr));
-
-	//Copy transforms and store mapping:
+	//Copy transforms (clear() keeps storage from previous contents around, so this doesn't allocate when sizes match):
 	transforms.clear();
+	transforms.reserve(other.transforms.size());
 	for (auto const &t : other.transforms) {
 		transforms.emplace_back();
 		transforms.back().name = t.name;
@@ -346,32 +1593,331 @@ void Scene::set(Scene const &other, std::unordered_map< Transform const *, Trans
 		transforms.back().rotation = t.rotation;
 		transforms.back().scale = t.scale;
 		transforms.back().parent = t.parent; //will update later
-
-		//store mapping between transforms old and new:
-		auto ret = transform_to_transform.insert(std::make_pair(&t, &transforms.back()));
-		assert(ret.second);
 	}
 
 	//update transform parents:
 	for (auto &t : transforms) {
-		t.parent = transform_to_transform.at(t.parent);
+		t.parent = remap(t.parent);
+	}
+
+	//store mapping between transforms old and new, if requested:
+	if (transform_map_) {
+		std::unordered_map< Transform const *, Transform * > &transform_to_transform = *transform_map_;
+		transform_to_transform.clear();
+		//null transform maps to itself:
+		transform_to_transform.insert(std::make_pair(nullptr, nullptr));
+		auto ti = transforms.begin();
+		for (auto const &t : other.transforms) {
+			transform_to_transform.insert(std::make_pair(&t, &*ti));
+			++ti;
+		}
+	}
+
+	//index names of the new transforms:
+	if (other.name_index.built && other.name_index.transform_count == other.transforms.size()) {
+		//names are shared with other's transforms, so other's index only needs its transform pointers remapped:
+		name_index.by_name.assign(other.name_index.by_name.begin(), other.name_index.by_name.end());
+		for (auto &entry : name_index.by_name) {
+			entry = remap(entry);
+		}
+		name_index.sorted.assign(other.name_index.sorted.begin(), other.name_index.sorted.end());
+		for (auto &entry : name_index.sorted) {
+			entry.second = remap(entry.second);
+		}
+		name_index.transform_count = transforms.size();
+		name_index.built = true;
+	} else {
+		rebuild_name_index();
 	}
 
 	//copy other's drawables, updating transform pointers:
 	drawables = other.drawables;
 	for (auto &d : drawables) {
-		d.transform = transform_to_transform.at(d.transform);
+		d.transform = remap(d.transform);
 	}
 
 	//copy other's cameras, updating transform pointers:
 	cameras = other.cameras;
 	for (auto &c : cameras) {
-		c.transform = transform_to_transform.at(c.transform);
+		c.transform = remap(c.transform);
 	}
 
 	//copy other's lights, updating transform pointers:
 	lights = other.lights;
 	for (auto &l : lights) {
-		l.transform = transform_to_transform.at(l.transform);
+		l.transform = remap(l.transform);
+	}
+
+	//other's draw list refers to other's transforms, so build a fresh one (in the old one's storage) if other had one:
+	draw_list.commands.clear();
+	draw_list.set_uniforms.clear();
+	draw_list.drawable_count = 0;
+	draw_list.compiled = false;
+	if (other.draw_list.compiled) compile();
+}
+
+//do two drawables draw the same thing? (set_uniforms functions can't be compared, so they are ignored)
+static bool same_drawable(Scene::Drawable const &a, Scene::Drawable const &b) {
+	Scene::Drawable::Pipeline const &pa = a.pipeline;
+	Scene::Drawable::Pipeline const &pb = b.pipeline;
+	if (pa.program != pb.program || pa.vao != pb.vao) return false;
+	if (pa.type != pb.type || pa.start != pb.start || pa.count != pb.count) return false;
+	if (pa.index_type != pb.index_type || pa.base_vertex != pb.base_vertex) return false;
+	if (pa.vertex_count != pb.vertex_count) return false;
+	if (pa.position_scale != pb.position_scale || pa.position_offset != pb.position_offset) return false;
+	if (pa.instanced.program != pb.instanced.program || pa.instanced.vao != pb.instanced.vao) return false;
+	if (pa.multi_draw.program != pb.multi_draw.program || pa.multi_draw.vao != pb.multi_draw.vao) return false;
+	for (uint32_t i = 0; i < Scene::Drawable::Pipeline::TextureCount; ++i) {
+		if (pa.textures[i].texture != pb.textures[i].texture || pa.textures[i].target != pb.textures[i].target) return false;
+	}
+	if (a.bounds_min != b.bounds_min || a.bounds_max != b.bounds_max || a.bounds_radius != b.bounds_radius) return false;
+	std::vector< Scene::Drawable::LOD > const &la = a.lods;
+	std::vector< Scene::Drawable::LOD > const &lb = b.lods;
+	if (la.size() != lb.size()) return false;
+	for (uint32_t i = 0; i < la.size(); ++i) {
+		if (la[i].start != lb[i].start || la[i].count != lb[i].count || la[i].screen_size != lb[i].screen_size) return false;
+		if (la[i].base_vertex != lb[i].base_vertex || la[i].vertex_count != lb[i].vertex_count) return false;
+		if (la[i].position_scale != lb[i].position_scale || la[i].position_offset != lb[i].position_offset) return false;
+	}
+	return true;
+}
+
+static bool same_camera(Scene::Camera const &a, Scene::Camera const &b) {
+	return a.fovy == b.fovy && a.aspect == b.aspect && a.near == b.near;
+}
+
+static bool same_light(Scene::Light const &a, Scene::Light const &b) {
+	return a.type == b.type && a.energy == b.energy && a.spot_fov == b.spot_fov && a.distance == b.distance;
+}
+
+//patch one kind of thing attached to transforms (drawables, cameras, or lights), matching by transform name:
+// returns the number of items added, changed, or removed
+template< typename T, typename Same >
+static uint32_t patch_attached(Scene &scene, StableVector< T > *items_, StableVector< T > const &before, StableVector< T > const &after,
+	Same const &same, bool remove_missing, bool *removed) {
+	assert(items_);
+	StableVector< T > &items = *items_;
+
+	//first item attached to a transform with each name:
+	auto by_name = [](StableVector< T > const &from) {
+		std::unordered_map< std::string_view, T const * > ret;
+		ret.reserve(from.size());
+		for (auto const &item : from) ret.emplace(*item.transform->name, &item);
+		return ret;
+	};
+	std::unordered_map< std::string_view, T const * > before_by_name = by_name(before);
+	std::unordered_map< std::string_view, T const * > after_by_name = by_name(after);
+
+	std::unordered_map< Scene::Transform const *, T * > attached;
+	attached.reserve(items.size());
+	for (auto &item : items) attached.emplace(item.transform, &item);
+
+	uint32_t count = 0;
+
+	//add or update items that are new or different in 'after':
+	for (auto const &a : after) {
+		if (after_by_name[*a.transform->name] != &a) continue; //(only the first item per name counts)
+		auto b = before_by_name.find(*a.transform->name);
+		if (b != before_by_name.end() && same(*b->second, a)) continue;
+
+		Scene::Transform *transform = scene.find_transform(*a.transform->name);
+		assert(transform); //(all of after's transforms exist by now)
+		auto f = attached.find(transform);
+		T *item = nullptr;
+		if (f != attached.end()) {
+			item = f->second;
+		} else {
+			item = &items.emplace_back(transform);
+			attached.emplace(transform, item);
+		}
+		*item = a;
+		item->transform = transform;
+		++count;
+	}
+
+	//remove items that are gone from 'after':
+	*removed = false;
+	if (remove_missing) {
+		std::unordered_set< T const * > gone;
+		for (auto const &b : before) {
+			if (after_by_name.count(*b.transform->name)) continue;
+			auto f = attached.find(scene.find_transform(*b.transform->name));
+			if (f != attached.end()) gone.insert(f->second);
+		}
+		if (!gone.empty()) {
+			StableVector< T > kept;
+			kept.reserve(items.size() - gone.size());
+			for (auto const &item : items) {
+				if (!gone.count(&item)) kept.emplace_back(item);
+			}
+			items = kept;
+			count += uint32_t(gone.size());
+			*removed = true;
+		}
+	}
+
+	return count;
+}
+
+Scene::PatchStats Scene::patch(Scene const &before, Scene const &after) {
+	PatchStats stats;
+
+	//----- transforms -----
+
+	//add missing transforms (all at once, so the name index is only rebuilt once):
+	std::unordered_set< std::string_view > missing;
+	for (auto const &a : after.transforms) {
+		if (!find_transform(*a.name)) missing.emplace(*a.name);
+	}
+	std::unordered_set< Transform const * > added;
+	for (auto const &a : after.transforms) {
+		if (!missing.erase(*a.name)) continue; //(only add one transform per name)
+		transforms.emplace_back();
+		transforms.back().name = a.name;
+		added.emplace(&transforms.back());
+	}
+	if (!added.empty()) rebuild_name_index();
+
+	//copy values and parents that changed:
+	for (auto const &a : after.transforms) {
+		Transform *t = find_transform(*a.name);
+		Transform const *b = before.find_transform(*a.name);
+		bool is_new = (b == nullptr || added.count(t));
+
+		bool changed = false;
+		if (is_new || a.position != b->position || a.rotation != b->rotation || a.scale != b->scale) {
+			t->position = a.position;
+			t->rotation = a.rotation;
+			t->scale = a.scale;
+			changed = true;
+		}
+
+		//(parents are compared by name, since they are different transforms in each scene)
+		std::string_view a_parent = (a.parent ? std::string_view(*a.parent->name) : std::string_view());
+		std::string_view b_parent = (b && b->parent ? std::string_view(*b->parent->name) : std::string_view());
+		if (is_new || (a.parent == nullptr) != (b->parent == nullptr) || a_parent != b_parent) {
+			t->parent = (a.parent ? find_transform(*a.parent->name) : nullptr);
+			changed = true;
+		}
+
+		if (changed) stats.transforms += 1;
+	}
+
+	//----- things attached to transforms -----
+	bool removed = false;
+	stats.drawables = patch_attached(*this, &drawables, before.drawables, after.drawables, same_drawable, true, &removed);
+	if (removed) release_queries(&occlusion_queries); //(queries are keyed by drawable pointer)
+	stats.cameras = patch_attached(*this, &cameras, before.cameras, after.cameras, same_camera, false, &removed);
+	stats.lights = patch_attached(*this, &lights, before.lights, after.lights, same_light, true, &removed);
+
+	if (draw_list.compiled && stats.drawables > 0) compile();
+
+	return stats;
+}
+
+//-------------------------
+
+void Scene::snapshot(Snapshot *into_) const {
+	assert(into_);
+	Snapshot &into = *into_;
+
+	into.transforms.clear();
+	into.transforms.reserve(transforms.size());
+	for (auto const &t : transforms) {
+		into.transforms.emplace_back(Snapshot::TransformState{t.position, t.rotation, t.scale});
+	}
+
+	into.drawables.clear();
+	into.drawables.reserve(drawables.size());
+	for (auto const &d : drawables) {
+		into.drawables.emplace_back(Snapshot::DrawableState{d.pipeline.type, d.pipeline.start, d.pipeline.count, d.pipeline.base_vertex, d.pipeline.vertex_count});
+	}
+}
+
+Scene::Snapshot Scene::snapshot() const {
+	Snapshot ret;
+	snapshot(&ret);
+	return ret;
+}
+
+//compares all the bits (so, e.g., -0.0f and 0.0f count as different; this errs on the side of recording a transform):
+static bool same_state(Scene::Snapshot::TransformState const &a, Scene::Transform const &b) {
+	return std::memcmp(&a.position, &b.position, sizeof(a.position)) == 0
+	    && std::memcmp(&a.rotation, &b.rotation, sizeof(a.rotation)) == 0
+	    && std::memcmp(&a.scale, &b.scale, sizeof(a.scale)) == 0;
+}
+
+void Scene::snapshot_delta(Snapshot const &base, DeltaSnapshot *into_) const {
+	assert(into_);
+	DeltaSnapshot &into = *into_;
+
+	if (base.transforms.size() != transforms.size()) {
+		throw std::runtime_error("Scene::snapshot_delta: base snapshot has " + std::to_string(base.transforms.size()) + " transforms, but scene has " + std::to_string(transforms.size()) + ".");
+	}
+
+	into.transform_count = transforms.size();
+	into.indices.clear();
+	into.transforms.clear();
+
+	uint32_t index = 0;
+	for (auto const &t : transforms) {
+		if (!same_state(base.transforms[index], t)) {
+			into.indices.emplace_back(index);
+			into.transforms.emplace_back(Snapshot::TransformState{t.position, t.rotation, t.scale});
+		}
+		++index;
+	}
+}
+
+void Scene::restore(Snapshot const &snapshot) {
+	if (snapshot.transforms.size() != transforms.size() || snapshot.drawables.size() != drawables.size()) {
+		throw std::runtime_error("Scene::restore: snapshot has " + std::to_string(snapshot.transforms.size()) + " transforms and " + std::to_string(snapshot.drawables.size()) + " drawables, but scene has " + std::to_string(transforms.size()) + " and " + std::to_string(drawables.size()) + ".");
+	}
+
+	auto ts = snapshot.transforms.begin();
+	for (auto &t : transforms) {
+		t.position = ts->position;
+		t.rotation = ts->rotation;
+		t.scale = ts->scale;
+		++ts;
+	}
+
+	//n.b. a compiled draw_list keeps its own copy of mesh ranges, so only recompile if they changed:
+	bool ranges_changed = false;
+	auto ds = snapshot.drawables.begin();
+	for (auto &d : drawables) {
+		if (d.pipeline.type != ds->type || d.pipeline.start != ds->start || d.pipeline.count != ds->count || d.pipeline.base_vertex != ds->base_vertex || d.pipeline.vertex_count != ds->vertex_count) {
+			d.pipeline.type = ds->type;
+			d.pipeline.start = ds->start;
+			d.pipeline.count = ds->count;
+			d.pipeline.base_vertex = ds->base_vertex;
+			d.pipeline.vertex_count = ds->vertex_count;
+			ranges_changed = true;
+		}
+		++ds;
+	}
+	if (ranges_changed && draw_list.compiled) compile();
+}
+
+void Scene::restore(Snapshot const &base, DeltaSnapshot const &delta) {
+	if (delta.transform_count != base.transforms.size()) {
+		throw std::runtime_error("Scene::restore: delta snapshot was taken against a base with " + std::to_string(delta.transform_count) + " transforms, but base has " + std::to_string(base.transforms.size()) + ".");
+	}
+	assert(delta.indices.size() == delta.transforms.size());
+
+	restore(base);
+
+	//transforms are in container order, so walk the container and the (increasing) delta indices together:
+	uint32_t index = 0;
+	size_t next = 0;
+	for (auto &t : transforms) {
+		if (next == delta.indices.size()) break;
+		if (delta.indices[next] == index) {
+			t.position = delta.transforms[next].position;
+			t.rotation = delta.transforms[next].rotation;
+			t.scale = delta.transforms[next].scale;
+			++next;
+		}
+		++index;
 	}
 }
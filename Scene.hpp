@@ -11,21 +11,26 @@
  */
 
 #include "GL.hpp"
+#include "Mesh.hpp"
+#include "StableVector.hpp"
+#include "Shared.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 
-#include <list>
 #include <memory>
 #include <functional>
+#include <limits>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
 
 struct Scene {
 	struct Transform {
 		//Transform names are useful for debugging and looking up locations in a loaded scene:
-		std::string name;
+		// (names are shared between copies of a scene; assign a new name rather than editing one in place)
+		Shared< std::string > name;
 
 		//The core function of a transform is to store a transformation in the world:
 		glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f);
@@ -43,6 +48,26 @@ struct Scene {
 		glm::mat4x3 make_local_to_world() const;
 		glm::mat4x3 make_world_to_local() const;
 
+		//..or, when asking every frame, get a cached local-to-world matrix:
+		// (only recomputed when this transform or one of its ancestors has changed)
+		glm::mat4x3 const &cached_local_to_world() const;
+		//..and the matching matrix for normals (the inverse transpose of the upper 3x3 of local-to-world):
+		glm::mat3 const &cached_normal_to_world() const;
+
+		//-- internals --
+		//used by cached_*_to_world() to notice changes:
+		struct WorldCache {
+			glm::vec3 position = glm::vec3(0.0f);
+			glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+			glm::vec3 scale = glm::vec3(0.0f);
+			Transform const *parent = nullptr;
+			uint32_t parent_version = 0; //parent's version when local_to_world was computed
+			uint32_t version = 0; //incremented whenever local_to_world is recomputed (0 => never computed)
+			glm::mat4x3 local_to_world = glm::mat4x3(1.0f);
+			glm::mat3 normal_to_world = glm::mat3(1.0f);
+		};
+		mutable WorldCache world_cache;
+
 		//since hierarchy is tracked through pointers, copy-constructing a transform  is not advised:
 		Transform(Transform const &) = delete;
 		//if we delete some constructors, we need to let the compiler know that the default constructor is still okay:
@@ -54,6 +79,31 @@ struct Scene {
 		Drawable(Transform *transform_) : transform(transform_) { assert(transform); }
 		Transform * transform;
 
+		//object-space bounding box (e.g., copied from Mesh::min and Mesh::max), used to find the lights that reach this drawable:
+		// (the default, empty box means "unknown" -- such drawables are lit by every light)
+		glm::vec3 bounds_min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 bounds_max = glm::vec3(-std::numeric_limits< float >::infinity());
+		//(optional) radius of a bounding sphere around the box's center (e.g., copied from Mesh::radius), used to pick levels of detail:
+		// (0 means "use the box's half-diagonal")
+		float bounds_radius = 0.0f;
+
+		//(optional) coarser levels of detail, ordered from most to least detailed:
+		// lods[i] is drawn instead of pipeline.start/count once the drawable's bounding sphere covers less than
+		// lods[i].screen_size of the viewport's height. Levels share pipeline.type and pipeline.vao, and need bounds to work.
+		// (MeshBuffer::lookup_lods finds levels exported as 'name.lod1', 'name.lod2', ...; the list is shared between copies of a drawable)
+		struct LOD {
+			GLuint start = 0; //first vertex (or index) to draw
+			GLuint count = 0; //number of vertices (or indices) to draw
+			float screen_size = 0.0f; //fraction of viewport height below which this level is used
+			GLint base_vertex = 0; //(indexed drawing) added to every index
+			GLuint vertex_count = 0; //(indexed drawing) number of vertices used, starting at base_vertex (needed for multi-draw batching)
+			glm::vec3 position_scale = glm::vec3(1.0f); //decoding of this level's positions (see Pipeline::position_scale)
+			glm::vec3 position_offset = glm::vec3(0.0f);
+		};
+		Shared< std::vector< LOD > > lods;
+		//level drawn last frame (0 = pipeline.start/count, i = lods[i-1]); remembered by draw() for hysteresis:
+		mutable uint32_t lod = 0;
+
 		//Contains all the data needed to run the OpenGL pipeline:
 		struct Pipeline {
 			GLuint program = 0; //shader program; passed to glUseProgram
@@ -65,12 +115,28 @@ struct Scene {
 			GLuint start = 0; //first vertex to draw; passed to glDrawArrays
 			GLuint count = 0; //number of vertices to draw; passed to glDrawArrays
 
+			//indexed drawing (e.g., meshes from .ipnct files):
+			// if index_type is set, start/count are a range of the element array buffer bound in 'vao', passed to glDrawElementsBaseVertex
+			GLenum index_type = GL_NONE; //GL_UNSIGNED_SHORT or GL_UNSIGNED_INT to draw indexed
+			GLint base_vertex = 0; //added to every index
+			GLuint vertex_count = 0; //number of vertices used, starting at base_vertex (needed for multi-draw batching)
+
+			//decoding of quantized positions (e.g., copied from Mesh::position_scale and Mesh::position_offset):
+			// the program's position attribute maps to object space as position_offset + position_scale * attribute;
+			// Scene::draw folds this into the object-to-clip and object-to-light (or object-to-world) matrices it sends.
+			// (normals are stored as-is, so normal matrices are unchanged)
+			glm::vec3 position_scale = glm::vec3(1.0f);
+			glm::vec3 position_offset = glm::vec3(0.0f);
+
 			//uniforms:
 			GLuint OBJECT_TO_CLIP_mat4 = -1U; //uniform location for object to clip space matrix
 			GLuint OBJECT_TO_LIGHT_mat4x3 = -1U; //uniform location for object to light space (== world space) matrix
 			GLuint NORMAL_TO_LIGHT_mat3 = -1U; //uniform location for normal to light space (== world space) matrix
 
-			std::function< void() > set_uniforms; //(optional) function to set any other useful uniforms
+			//(alternatively) the above matrices may be read from a uniform block laid out like Scene::ObjectBlock:
+			GLuint OBJECT_block = -1U; //uniform block index; program must bind it to Scene::ObjectBlockBinding
+
+			Shared< std::function< void() > > set_uniforms; //(optional) function to set any other useful uniforms
 
 			//texture objects to bind for the first TextureCount textures:
 			enum : uint32_t { TextureCount = 4 };
@@ -78,8 +144,86 @@ struct Scene {
 				GLuint texture = 0;
 				GLenum target = GL_TEXTURE_2D;
 			} textures[TextureCount];
+
+			//(optional) instanced version of this pipeline:
+			// when several drawables have identical pipelines (and no set_uniforms), Scene::draw will
+			// draw them all with one glDrawArraysInstanced call using this program and vertex array.
+			// The program must read per-instance matrices from the attribute locations given by
+			// InstanceObjectToWorldLocation (mat4x3) and InstanceNormalToWorldLocation (mat3).
+			struct Instanced {
+				GLuint program = 0; //shader program used for instanced drawing
+				GLuint vao = 0; //same vertex data as 'vao', bound for 'program'; Scene::draw adds the instance attributes
+
+				//uniforms:
+				GLuint WORLD_TO_CLIP_mat4 = -1U; //uniform location for world to clip space matrix
+				GLuint WORLD_TO_LIGHT_mat4x3 = -1U; //uniform location for world to light space matrix
+				GLuint NORMAL_WORLD_TO_LIGHT_mat3 = -1U; //uniform location for (world) normal to light space matrix
+			} instanced;
+
+			//(optional) multi-draw version of this pipeline:
+			// when several drawables that draw *different* meshes share program, vertex array, and textures (and have
+			// no set_uniforms), Scene::draw will draw them all with one glMultiDrawArrays (or glMultiDrawElementsBaseVertex)
+			// call using this program and vertex array.
+			// OpenGL 3.3 has no gl_DrawID, so Scene::draw supplies one as a per-vertex attribute at DrawIDLocation
+			// (uint, from a buffer it attaches to 'vao', written for each mesh's vertex range when a batch changes).
+			// The program adds the DRAW_BASE_int uniform to it and reads the drawable's matrices from a buffer texture
+			// bound to MultiDrawMatricesUnit: six RGBA32F texels per drawable, the three rows of object-to-world followed
+			// by the three columns of normal-to-world (in .xyz).
+			struct MultiDraw {
+				GLuint program = 0; //shader program used for multi-draw batches
+				GLuint vao = 0; //same vertex data as 'vao', bound for 'program'; Scene::draw adds the draw id attribute
+
+				//uniforms:
+				GLuint DRAW_BASE_int = -1U; //uniform location for the index of the batch's first drawable in the matrices texture
+				GLuint WORLD_TO_CLIP_mat4 = -1U; //uniform location for world to clip space matrix
+				GLuint WORLD_TO_LIGHT_mat4x3 = -1U; //uniform location for world to light space matrix
+				GLuint NORMAL_WORLD_TO_LIGHT_mat3 = -1U; //uniform location for (world) normal to light space matrix
+			} multi_draw;
 		} pipeline;
+
+		//attribute locations used for per-instance (or per-draw) data by instanced (or multi-draw) pipelines:
+		// (inside the range MeshBuffer vertex arrays leave free)
+		enum : GLuint {
+			InstanceObjectToWorldLocation = MeshBuffer::ReservedLocationsBegin, //mat4x3 -- uses locations 4,5,6,7
+			InstanceNormalToWorldLocation = InstanceObjectToWorldLocation + 4, //mat3 -- uses locations 8,9,10
+			DrawIDLocation = InstanceNormalToWorldLocation + 3, //uint -- (multi-draw pipelines) index of the drawable within its batch
+		};
+		static_assert(GLuint(DrawIDLocation) < GLuint(MeshBuffer::ReservedLocationsEnd), "per-instance and per-draw attributes must fit in the locations mesh vertex arrays leave free");
+		//texture unit multi-draw pipelines read per-drawable matrices from (after the units used by LightGrid):
+		enum : GLuint { MultiDrawMatricesUnit = Pipeline::TextureCount + 3 };
+	};
+
+	//Limits on lighting:
+	enum : uint32_t {
+		MaxLights = 16, //lights past the first MaxLights in 'lights' are ignored by draw()
+		MaxObjectLights = 8, //each drawable is lit by (at most) this many of the lights that reach it
+	};
+
+	//Layout (std140) of the per-object uniform block read by pipelines that set OBJECT_block:
+	// GLSL: layout(std140) uniform Object { mat4 OBJECT_TO_CLIP; mat4x3 OBJECT_TO_LIGHT; mat3 NORMAL_TO_LIGHT; ivec4 LIGHT_INDICES[MaxObjectLights/4]; };
+	struct ObjectBlock {
+		glm::mat4 OBJECT_TO_CLIP;
+		glm::vec4 OBJECT_TO_LIGHT[4]; //std140 pads each mat4x3 column to a vec4
+		glm::vec4 NORMAL_TO_LIGHT[3]; //std140 pads each mat3 column to a vec4
+		glm::ivec4 LIGHT_INDICES[MaxObjectLights / 4]; //indices (in LightsBlock::LIGHTS) of lights that reach the object; -1 after the last one
+	};
+	static_assert(sizeof(ObjectBlock) == 64 + 64 + 48 + 4 * MaxObjectLights, "ObjectBlock matches std140 layout.");
+
+	//Layout (std140) of the uniform block holding all lights, packed once per call to draw():
+	// GLSL: struct Light { vec4 POSITION; vec4 DIRECTION; vec4 ENERGY; };
+	//       layout(std140) uniform Lights { ivec4 LIGHT_COUNT; Light LIGHTS[MaxLights]; };
+	struct LightsBlock {
+		glm::ivec4 LIGHT_COUNT; //x: number of entries of LIGHTS in use
+		struct Entry {
+			glm::vec4 POSITION; //xyz: position in light space, w: type (0 = point, 1 = hemisphere, 2 = spot, 3 = directional)
+			glm::vec4 DIRECTION; //xyz: direction the light shines in light space, w: cosine of spot cutoff angle
+			glm::vec4 ENERGY; //rgb: energy, a: range (0 = unlimited)
+		} LIGHTS[MaxLights];
 	};
+	static_assert(sizeof(LightsBlock) == 16 + 48 * MaxLights, "LightsBlock matches std140 layout.");
+
+	//uniform buffer binding points that Scene::draw binds per-object blocks and the lights block to:
+	enum : GLuint { ObjectBlockBinding = 0, LightsBlockBinding = 1 };
 
 	struct Camera {
 		//a 'Camera' attaches camera data to a transform:
@@ -114,20 +258,139 @@ struct Scene {
 
 		//Spotlight specific:
 		float spot_fov = glm::radians(45.0f); //spot cone fov (in radians)
+
+		//Point and spot lights only:
+		float distance = 0.0f; //light has no effect past this distance (0 = unlimited)
 	};
 
 	//Scenes, of course, may have many of the above objects:
-	std::list< Transform > transforms;
-	std::list< Drawable > drawables;
-	std::list< Camera > cameras;
-	std::list< Light > lights;
+	// (StableVector works like std::list -- pointers to elements stay valid as more are added -- but allocates in chunks)
+	StableVector< Transform > transforms;
+	StableVector< Drawable > drawables;
+	StableVector< Camera > cameras;
+	StableVector< Light > lights;
 
 	//The "draw" function provides a convenient way to pass all the things in a scene to OpenGL:
+	// (drawables are sorted by program, vertex array, textures, and then depth; state changes are only sent when needed)
+	// (drawables that share a mesh and have an instanced pipeline are drawn together with one call)
+	// (runs of drawables with different meshes but the same state and a multi-draw pipeline are also drawn with one call)
+	// (lights are packed into a uniform block at LightsBlockBinding; drawables with an object block also get a list of the lights that reach their bounds)
+	// (per-drawable CPU work -- level of detail, sort keys, matrices, light lists -- is spread over Jobs::shared(); OpenGL is only called from the calling thread)
 	void draw(Camera const &camera) const;
 
 	//..sometimes, you want to draw with a custom projection matrix and/or light space:
 	void draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f)) const;
 
+	//Look up transforms by name:
+	// (uses a hash index built when the scene is loaded or copied, and rebuilt if transforms have been added since)
+	// returns nullptr if no transform has the name; if several do, returns the first one.
+	Transform *find_transform(std::string_view name);
+	Transform const *find_transform(std::string_view name) const;
+	//..all transforms whose names start with 'prefix' (in name order):
+	std::vector< Transform * > find_transforms_with_prefix(std::string_view prefix);
+	//..all transforms whose names match 'pattern' (in name order), where '*' matches any run of characters and '?' matches one character:
+	std::vector< Transform * > find_transforms_matching(std::string_view pattern);
+
+	//If you rename transforms (or remove some), the index needs to be rebuilt:
+	void rebuild_name_index() const;
+
+	//-- internals --
+	//used by the find_transform* functions:
+	struct NameIndex {
+		//open-addressed hash table of transforms by name (size is a power of two; nullptr marks an empty slot):
+		// (flat, so that Scene::set can copy another scene's index by remapping pointers, re-using this one's storage)
+		std::vector< Transform * > by_name;
+		std::vector< std::pair< std::string_view, Transform * > > sorted; //sorted by name, for prefix queries; views point into Transform::name
+		size_t transform_count = 0; //transforms.size() when built
+		bool built = false;
+	};
+	mutable NameIndex name_index;
+
+	//A DrawList is a flat, pre-sorted copy of the state needed to draw each drawable:
+	// compile() builds 'draw_list' so that draw() can just walk it every frame.
+	// Transform changes are picked up automatically (via Transform::cached_local_to_world);
+	// if you add or remove drawables or change their pipelines, call compile() again.
+	// (draw() falls back to building a temporary list every frame if drawables.size() no longer matches)
+	struct DrawList {
+		struct Command {
+			uint64_t state_key = 0; //program / vertex array / texture part of the sort key
+			Drawable const *drawable = nullptr;
+			Transform const *transform = nullptr;
+			//copied from Drawable::Pipeline:
+			GLuint program = 0;
+			GLuint vao = 0;
+			GLenum type = GL_TRIANGLES;
+			GLuint start = 0;
+			GLuint count = 0;
+			GLenum index_type = GL_NONE;
+			GLint base_vertex = 0;
+			GLuint vertex_count = 0;
+			glm::vec3 position_scale = glm::vec3(1.0f);
+			glm::vec3 position_offset = glm::vec3(0.0f);
+			GLuint OBJECT_TO_CLIP_mat4 = -1U;
+			GLuint OBJECT_TO_LIGHT_mat4x3 = -1U;
+			GLuint NORMAL_TO_LIGHT_mat3 = -1U;
+			GLuint OBJECT_block = -1U;
+			glm::vec3 bounds_min, bounds_max; //copied from Drawable
+			uint32_t set_uniforms = -1U; //index into DrawList::set_uniforms, or -1U if none
+			Drawable::Pipeline::TextureInfo textures[Drawable::Pipeline::TextureCount];
+			Drawable::Pipeline::Instanced instanced;
+			Drawable::Pipeline::MultiDraw multi_draw;
+		};
+		std::vector< Command > commands;
+		std::vector< std::function< void() > const * > set_uniforms; //points into drawables' pipelines
+		size_t drawable_count = 0; //drawables.size() when compiled
+		bool compiled = false;
+	};
+	DrawList draw_list;
+
+	//(re-)build draw_list from drawables:
+	void compile();
+
+	//Counts of the OpenGL calls made by the most recent call to draw():
+	// (useful for checking that state sorting is doing its job)
+	struct DrawStats {
+		uint32_t drawables = 0; //drawables sent to OpenGL
+		uint32_t programs = 0; //glUseProgram calls
+		uint32_t vaos = 0; //glBindVertexArray calls
+		uint32_t textures = 0; //glActiveTexture + glBindTexture calls
+		uint32_t uniforms = 0; //glUniform* calls (not counting those made by set_uniforms)
+		uint32_t blocks = 0; //glBindBufferRange calls for per-object uniform blocks
+		uint32_t draws = 0; //glDraw* calls (an instanced draw counts once, no matter how many drawables it covers)
+		uint32_t multi_drawn = 0; //drawables sent with glMultiDraw* calls (each call counts once in 'draws')
+		uint32_t draw_ids = 0; //draw id attribute values re-uploaded for multi-draw batches
+		uint32_t lights = 0; //lights packed into the lights block
+		uint32_t object_lights = 0; //total length of per-object light lists (i.e., lights evaluated per fragment, summed over drawables)
+		uint32_t occluded = 0; //drawables skipped because their bounding box was hidden last time it was tested
+		uint32_t occlusion_queries = 0; //bounding boxes drawn with occlusion queries (each is one glDrawArrays call)
+		uint32_t lowered = 0; //drawables drawn at a coarser level of detail
+		uint32_t vertices = 0; //vertices sent to glDraw* calls (summed over instances)
+		uint32_t total() const { return programs + vaos + textures + uniforms + blocks + draws; }
+	};
+	mutable DrawStats draw_stats;
+
+	//Level of detail switching:
+	// a drawable only moves to a coarser level once its screen size is this fraction below the level's threshold,
+	// and back once it is this fraction above, so drawables near a threshold don't flicker between levels:
+	float lod_hysteresis = 0.1f;
+
+	//Occlusion culling (optional):
+	// When enabled, draw() finishes by drawing the bounding box (Drawable::bounds_min/max) of each drawable under a
+	// GL_ANY_SAMPLES_PASSED query, tested against (but not written to) the depth buffer it just drew.
+	// Drawables whose box was hidden are skipped until a later query finds them visible again.
+	// Results are read one frame late, and only once the GPU says they are available, so draw() never waits on a query;
+	// the price is that something coming out from behind an occluder can appear a frame or so late.
+	// (drawables without bounds are always drawn; expects depth testing to be enabled, as it is for normal drawing)
+	bool occlusion_culling = false;
+
+	//used by occlusion culling to track each drawable's most recent query:
+	struct OcclusionQuery {
+		GLuint query = 0; //query object (0 until first needed)
+		bool pending = false; //issued, but result not read yet
+		bool visible = true; //most recent result
+	};
+	mutable std::unordered_map< Drawable const *, OcclusionQuery > occlusion_queries;
+
 	//add transforms/objects/cameras from a scene file to this scene:
 	// the 'on_drawable' callback gives your code a chance to look up mesh data and make Drawables:
 	// throws on file format errors
@@ -137,17 +400,78 @@ struct Scene {
 
 	//this function is called to read extra chunks from the scene file after the main chunks are read:
 	// this is useful if you, e.g., subclassing scene to represent a game level/area
-	virtual void load_extra(std::istream &from, std::vector< char > const &str0, std::vector< Transform * > const &xfh0) { }
+	// (str0 points into the mapped file, so it is only valid during the call)
+	virtual void load_extra(std::istream &from, std::string_view str0, std::vector< Transform * > const &xfh0) { }
 
 	//empty scene:
 	Scene() = default;
+	virtual ~Scene();
 
 	//load a scene:
 	Scene(std::string const &filename, std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable);
 
 	//copy a scene (with proper pointer fixup):
+	// (pointers are fixed up by index, names and LOD lists are shared rather than copied, and storage from this
+	//  scene's previous contents is re-used, so re-copying a scene -- e.g., to restart a level -- doesn't need to
+	//  allocate unless it is bigger than before or a transform_map is requested)
 	Scene(Scene const &); //...as a constructor
 	Scene &operator=(Scene const &); //...as scene = scene
 	//... as a set() function that optionally returns the transform->transform mapping:
 	void set(Scene const &, std::unordered_map< Transform const *, Transform * > *transform_map = nullptr);
+
+	//Hot reload: apply the differences between two versions of a scene (e.g., a file as loaded before and after it was
+	// re-exported) to this scene, matching transforms by name, without rebuilding anything that didn't change:
+	// - transforms in 'after' are added if missing; position/rotation/scale/parent are copied only if they differ from 'before'
+	//   (so transforms the game has moved keep their state unless the file moved them too)
+	// - drawables, cameras, and lights (matched by the name of their transform) are added or updated if they differ from 'before'
+	// - drawables and lights that were in 'before' but not in 'after' are removed (pointers to the other drawables/lights
+	//   are invalidated in that case); transforms and cameras are never removed, since code usually holds pointers to them
+	// If draw_list was compiled, it is recompiled.
+	struct PatchStats {
+		uint32_t transforms = 0; //added or changed
+		uint32_t drawables = 0; //added, changed, or removed
+		uint32_t cameras = 0; //added or changed
+		uint32_t lights = 0; //added, changed, or removed
+	};
+	PatchStats patch(Scene const &before, Scene const &after);
+
+	//Snapshots record the parts of a scene that usually change during play -- transform position/rotation/scale and
+	// which mesh range each drawable draws -- so that the scene can be rewound (e.g., to restart a level) without a full copy.
+	// Entries are stored in container order, so a snapshot only restores into the scene it came from
+	// (or a copy of it made with set()) as long as no transforms or drawables have been added or removed.
+	struct Snapshot {
+		struct TransformState {
+			glm::vec3 position;
+			glm::quat rotation;
+			glm::vec3 scale;
+		};
+		struct DrawableState {
+			GLenum type;
+			GLuint start;
+			GLuint count;
+			GLint base_vertex;
+			GLuint vertex_count;
+		};
+		std::vector< TransformState > transforms;
+		std::vector< DrawableState > drawables;
+	};
+	//a delta snapshot stores only the transforms that differ from some base snapshot:
+	struct DeltaSnapshot {
+		size_t transform_count = 0; //transforms.size() when taken (checked against the base)
+		std::vector< uint32_t > indices; //which transforms changed
+		std::vector< Snapshot::TransformState > transforms; //their state (same order as indices)
+	};
+
+	//record current state:
+	// (re-using a snapshot re-uses its storage, so taking snapshots regularly doesn't allocate)
+	void snapshot(Snapshot *into) const;
+	Snapshot snapshot() const;
+	//record transforms that have changed since 'base':
+	void snapshot_delta(Snapshot const &base, DeltaSnapshot *into) const;
+
+	//write recorded state back into the scene (never allocates):
+	// throws if the scene no longer has the same number of transforms/drawables as when the snapshot was taken
+	void restore(Snapshot const &snapshot);
+	//restore 'base' and then apply 'delta' on top of it:
+	void restore(Snapshot const &base, DeltaSnapshot const &delta);
 };
@@ -0,0 +1,44 @@
+#pragma once
+
+/*
+ * A Shared< T > holds an immutable T that copies of it share.
+ *
+ * Copying a Shared< T > copies a (reference-counted) pointer instead of the
+ * value, so things that are copied often but rarely changed -- like transform
+ * names in a Scene that gets copied to restart a level -- can be copied
+ * without allocating.
+ *
+ * The value can't be changed in place; assign a new value instead:
+ *    Shared< std::string > name = "Hip";
+ *    name = std::string(*name) + ".FL"; //(other copies still hold "Hip")
+ *
+ * A default-constructed Shared< T > holds a default-constructed T.
+ *
+ */
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+template< typename T >
+struct Shared {
+	Shared() = default;
+	//make a new value from anything a T can be made from:
+	template< typename U, typename = std::enable_if_t<
+		!std::is_same_v< std::decay_t< U >, Shared > && std::is_constructible_v< T, U && >
+	> >
+	Shared(U &&value_) : value(std::make_shared< T const >(std::forward< U >(value_))) { }
+
+	T const &operator*() const { return value ? *value : empty(); }
+	T const *operator->() const { return &**this; }
+	operator T const &() const { return **this; }
+
+	//-- internals --
+	std::shared_ptr< T const > value; //nullptr => default-constructed T
+
+private:
+	static T const &empty() {
+		static T const ret;
+		return ret;
+	}
+};
@@ -142,7 +142,7 @@ void ShowMeshesMode::draw(glm::uvec2 const &drawable_size) {
 		draw_lines.draw_box(mat, glm::u8vec4(0xdd, 0xdd, 0xdd, 0xff));
 
 		//mesh name:
-		draw_lines.draw_text("'" + current_mesh_name + "'",
+		draw_lines.draw_text("'" + (current_mesh != MeshBuffer::InvalidHandle ? buffer.name(current_mesh) : std::string()) + "'",
 			current_mesh_min + glm::vec3(0.0f, -0.20f, 0.0f),
 			0.15f * glm::vec3(1.0f, 0.0f, 0.0f),
 			0.15f * glm::vec3(0.0f, 1.0f, 0.0f),
@@ -152,48 +152,32 @@ void ShowMeshesMode::draw(glm::uvec2 const &drawable_size) {
 }
 
 void ShowMeshesMode::select_prev_mesh() {
-	auto f = buffer.meshes.find(current_mesh_name);
-	if (f != buffer.meshes.end()) --f;
-	if (f == buffer.meshes.end()) f = buffer.meshes.begin();
-
-	if (f != buffer.meshes.end()) {
-		current_mesh_name = f->first;
-		scene_drawable->pipeline.type = f->second.type;
-		scene_drawable->pipeline.start = f->second.start;
-		scene_drawable->pipeline.count = f->second.count;
-		current_mesh_min = f->second.min;
-		current_mesh_max = f->second.max;
-	} else {
-		current_mesh_name = "";
-		scene_drawable->pipeline.type = GL_TRIANGLES;
-		scene_drawable->pipeline.start = 0;
-		scene_drawable->pipeline.count = 0;
-		current_mesh_min = glm::vec3(0.0f);
-		current_mesh_max = glm::vec3(0.0f);
-	}
+	if (buffer.mesh_count() == 0) select_mesh(MeshBuffer::InvalidHandle);
+	else if (current_mesh == MeshBuffer::InvalidHandle || current_mesh >= buffer.mesh_count()) select_mesh(0);
+	else if (current_mesh > 0) select_mesh(current_mesh - 1);
 }
 
 void ShowMeshesMode::select_next_mesh() {
-	auto f = buffer.meshes.find(current_mesh_name);
-	if (f != buffer.meshes.end()) ++f;
-	if (f == buffer.meshes.end()) {
-		auto temp = buffer.meshes.rbegin();
-		if (temp != buffer.meshes.rend()) {
-			++temp;
-			f = temp.base();
-			assert(f != buffer.meshes.end());
-		}
-	}
+	if (buffer.mesh_count() == 0) select_mesh(MeshBuffer::InvalidHandle);
+	else if (current_mesh == MeshBuffer::InvalidHandle || current_mesh >= buffer.mesh_count()) select_mesh(0);
+	else if (current_mesh + 1 < buffer.mesh_count()) select_mesh(current_mesh + 1);
+}
 
-	if (f != buffer.meshes.end()) {
-		current_mesh_name = f->first;
-		scene_drawable->pipeline.type = f->second.type;
-		scene_drawable->pipeline.start = f->second.start;
-		scene_drawable->pipeline.count = f->second.count;
-		current_mesh_min = f->second.min;
-		current_mesh_max = f->second.max;
+void ShowMeshesMode::select_mesh(MeshBuffer::Handle handle) {
+	current_mesh = handle;
+	if (handle != MeshBuffer::InvalidHandle) {
+		Mesh const &mesh = buffer.get(handle);
+		scene_drawable->pipeline.type = mesh.type;
+		scene_drawable->pipeline.start = mesh.start;
+		scene_drawable->pipeline.count = mesh.count;
+		scene_drawable->pipeline.index_type = mesh.index_type;
+		scene_drawable->pipeline.base_vertex = mesh.base_vertex;
+		scene_drawable->pipeline.vertex_count = mesh.vertex_count;
+		scene_drawable->pipeline.position_scale = mesh.position_scale;
+		scene_drawable->pipeline.position_offset = mesh.position_offset;
+		current_mesh_min = mesh.min;
+		current_mesh_max = mesh.max;
 	} else {
-		current_mesh_name = "";
 		scene_drawable->pipeline.type = GL_TRIANGLES;
 		scene_drawable->pipeline.start = 0;
 		scene_drawable->pipeline.count = 0;
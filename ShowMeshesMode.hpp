@@ -30,12 +30,13 @@ struct ShowMeshesMode : Mode {
 	//MeshBuffer being viewed:
 	MeshBuffer const &buffer;
 
-	//currently selected mesh:
-	std::string current_mesh_name = "";
+	//currently selected mesh (meshes are stepped through in handle order, which is name order):
+	MeshBuffer::Handle current_mesh = MeshBuffer::InvalidHandle;
 	glm::vec3 current_mesh_min = glm::vec3(0.0f);
 	glm::vec3 current_mesh_max = glm::vec3(0.0f);
 	void select_prev_mesh();
 	void select_next_mesh();
+	void select_mesh(MeshBuffer::Handle handle); //(InvalidHandle selects nothing)
 	
 	//Vertex array object used to bind mesh buffer for drawing:
 	GLuint vao = 0;
@@ -3,7 +3,7 @@
 
 #include <iostream>
 
-ShowSceneMode::ShowSceneMode(Scene const &scene_) : scene(scene_) {
+ShowSceneMode::ShowSceneMode(Scene &scene_) : scene(scene_) {
 
 	//Set up camera-only scene:
 	{ //create a single camera:
@@ -61,6 +61,12 @@ bool ShowSceneMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_
 			return true;
 		}
 	}
+	//'O' key: toggle occlusion culling
+	if (evt.type == SDL_KEYDOWN && evt.key.keysym.sym == SDLK_o) {
+		scene.occlusion_culling = !scene.occlusion_culling;
+		std::cout << "Occlusion culling " << (scene.occlusion_culling ? "on" : "off") << "." << std::endl;
+		return true;
+	}
 	//mouse wheel: dolly
 	if (evt.type == SDL_MOUSEWHEEL) {
 		camera.radius *= std::pow(0.5f, 0.1f * evt.wheel.y);
@@ -121,7 +127,7 @@ void ShowSceneMode::draw(glm::uvec2 const &drawable_size) {
 			draw_lines.draw(xf(glm::vec3(0.0f)), xf(glm::vec3(0.0f, 0.0f, -len)), glm::u8vec4(0x00, 0x00, 0x88, 0xff));
 
 			//transform name:
-			draw_lines.draw_text("'" + transform.name + "'",
+			draw_lines.draw_text("'" + *transform.name + "'",
 				xf(glm::vec3(0.05f, 0.0f, 0.05f)),
 				0.15f * xfd(glm::vec3(1.0f, 0.0f, 0.0f)),
 				0.15f * xfd(glm::vec3(0.0f, 0.0f, 1.0f)),
@@ -136,4 +142,30 @@ void ShowSceneMode::draw(glm::uvec2 const &drawable_size) {
 		*/
 	}
 
+	{ //overlay draw statistics:
+		glDisable(GL_DEPTH_TEST);
+		float aspect = float(drawable_size.x) / float(drawable_size.y);
+		DrawLines lines(glm::mat4(
+			1.0f / aspect, 0.0f, 0.0f, 0.0f,
+			0.0f, 1.0f, 0.0f, 0.0f,
+			0.0f, 0.0f, 1.0f, 0.0f,
+			0.0f, 0.0f, 0.0f, 1.0f
+		));
+
+		Scene::DrawStats const &stats = scene.draw_stats;
+		std::string text = "drawn: " + std::to_string(stats.drawables) + " in " + std::to_string(stats.draws) + " draws"
+			+ ", " + std::to_string(stats.vertices) + " vertices (" + std::to_string(stats.lowered) + " at lower detail)";
+		if (scene.occlusion_culling) {
+			text += "; occluded: " + std::to_string(stats.occluded) + ", queries: " + std::to_string(stats.occlusion_queries);
+		} else {
+			text += "; (O: occlusion culling)";
+		}
+
+		constexpr float H = 0.06f;
+		lines.draw_text(text,
+			glm::vec3(-aspect + 0.1f * H, -1.0f + 0.1f * H, 0.0f),
+			glm::vec3(H, 0.0f, 0.0f), glm::vec3(0.0f, H, 0.0f),
+			glm::u8vec4(0xff, 0xff, 0xff, 0x00));
+	}
+
 }
@@ -88,6 +88,7 @@ ShowSceneProgram::ShowSceneProgram() {
 }
 
 ShowSceneProgram::~ShowSceneProgram() {
+	MeshArena::forget_program(program); //(vertex arrays were made for it by MeshBuffer::make_vao_for_program)
 	glDeleteProgram(program);
 	program = 0;
 }
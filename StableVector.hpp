@@ -0,0 +1,171 @@
+#pragma once
+
+/*
+ * A StableVector< T > is a sequence container that stores its elements in a
+ * few large contiguous chunks which are never reallocated.
+ *
+ * Like std::list (and unlike std::vector), pointers to elements stay valid
+ * as more elements are added, so it is safe to keep pointers into it.
+ * Unlike std::list, it doesn't allocate per element: reserve() sets aside
+ * room for many elements at once, and clear() keeps the chunks around for
+ * the next batch of elements.
+ *
+ * Elements can be found by index (operator[]) and pointers can be turned back
+ * into indices (index_of()); both cost O(number of chunks), which is O(1) for
+ * containers filled after a reserve().
+ *
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+template< typename T >
+struct StableVector {
+	StableVector() = default;
+	StableVector(StableVector const &other) { *this = other; }
+	StableVector &operator=(StableVector const &other) {
+		if (this == &other) return *this;
+		clear();
+		reserve(other.size());
+		for (auto const &t : other) emplace_back(t);
+		return *this;
+	}
+	~StableVector() {
+		clear();
+		for (auto &chunk : chunks) {
+			std::allocator< T >().deallocate(chunk.data, chunk.capacity);
+		}
+	}
+
+	//make sure 'total' elements can be stored without allocating again:
+	void reserve(size_t total) {
+		size_t capacity = 0;
+		for (auto const &chunk : chunks) capacity += chunk.capacity;
+		if (total > capacity) add_chunk(total - capacity);
+	}
+
+	template< typename... Args >
+	T &emplace_back(Args&&... args) {
+		//find the first chunk with room (all chunks before it are full):
+		while (current < chunks.size() && chunks[current].size == chunks[current].capacity) ++current;
+		if (current == chunks.size()) {
+			//grow geometrically so that the number of chunks stays small:
+			add_chunk(std::max(size_t(16), count));
+		}
+		Chunk &chunk = chunks[current];
+		T *t = new (chunk.data + chunk.size) T(std::forward< Args >(args)...);
+		chunk.size += 1;
+		count += 1;
+		return *t;
+	}
+
+	//destroys all elements, but keeps storage for re-use:
+	void clear() {
+		for (auto &chunk : chunks) {
+			for (size_t i = 0; i < chunk.size; ++i) {
+				chunk.data[i].~T();
+			}
+			chunk.size = 0;
+		}
+		count = 0;
+		current = 0;
+	}
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	T &front() { assert(count > 0); return chunks[0].data[0]; }
+	T const &front() const { assert(count > 0); return chunks[0].data[0]; }
+	T &back() { assert(count > 0); return chunks[current].data[chunks[current].size - 1]; }
+	T const &back() const { assert(count > 0); return chunks[current].data[chunks[current].size - 1]; }
+
+	T &operator[](size_t index) {
+		return const_cast< T & >(static_cast< StableVector const & >(*this)[index]);
+	}
+	T const &operator[](size_t index) const {
+		assert(index < count);
+		for (auto const &chunk : chunks) {
+			if (index < chunk.size) return chunk.data[index];
+			index -= chunk.size;
+		}
+		assert(0 && "index out of range");
+		return chunks[0].data[0];
+	}
+
+	//index of an element in this container, or -1 if the pointer doesn't point to an element:
+	size_t index_of(T const *t) const {
+		size_t base = 0;
+		for (auto const &chunk : chunks) {
+			if (t >= chunk.data && t < chunk.data + chunk.size) return base + size_t(t - chunk.data);
+			base += chunk.size;
+		}
+		return size_t(-1);
+	}
+
+	//forward iteration (in the order elements were added):
+	template< typename V >
+	struct Iterator {
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = V *;
+		using reference = V &;
+
+		Iterator() = default;
+		Iterator(StableVector const *owner_, size_t chunk_, size_t index_) : owner(owner_), chunk(chunk_), index(index_) { skip_empty(); }
+
+		V &operator*() const { return owner->chunks[chunk].data[index]; }
+		V *operator->() const { return &owner->chunks[chunk].data[index]; }
+		Iterator &operator++() { ++index; skip_empty(); return *this; }
+		Iterator operator++(int) { Iterator ret = *this; ++(*this); return ret; }
+		bool operator==(Iterator const &o) const { return chunk == o.chunk && index == o.index; }
+		bool operator!=(Iterator const &o) const { return !(*this == o); }
+
+		StableVector const *owner = nullptr;
+		size_t chunk = 0;
+		size_t index = 0;
+	private:
+		//move past the end of filled chunks (elements are never followed by an empty chunk, but partially-filled chunks may be):
+		void skip_empty() {
+			while (chunk < owner->chunks.size() && index >= owner->chunks[chunk].size) {
+				if (owner->chunks[chunk].size < owner->chunks[chunk].capacity) {
+					chunk = owner->chunks.size(); //a partially filled chunk is the last one with elements
+				} else {
+					++chunk;
+				}
+				index = 0;
+			}
+		}
+	};
+	using iterator = Iterator< T >;
+	using const_iterator = Iterator< T const >;
+
+	iterator begin() { return iterator(this, 0, 0); }
+	iterator end() { return iterator(this, chunks.size(), 0); }
+	const_iterator begin() const { return const_iterator(this, 0, 0); }
+	const_iterator end() const { return const_iterator(this, chunks.size(), 0); }
+
+	//-- internals --
+	struct Chunk {
+		T *data = nullptr;
+		size_t size = 0;
+		size_t capacity = 0;
+	};
+	std::vector< Chunk > chunks;
+	size_t count = 0; //total elements
+	size_t current = 0; //chunk that the next element goes into (or a full chunk before it)
+
+private:
+	void add_chunk(size_t capacity) {
+		Chunk chunk;
+		chunk.data = std::allocator< T >().allocate(capacity);
+		chunk.capacity = capacity;
+		chunks.emplace_back(chunk);
+	}
+};
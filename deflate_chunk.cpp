@@ -0,0 +1,155 @@
+#include "deflate_chunk.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+struct DeflateHeader {
+	char magic[4] = {'z', 'l', 'i', 'b'};
+	uint32_t size = 0; //size of everything after this header
+	char wrapped_magic[4] = {'\0', '\0', '\0', '\0'};
+	uint32_t wrapped_size = 0; //uncompressed size of the wrapped chunk's data
+};
+static_assert(sizeof(DeflateHeader) == 16, "header is packed");
+
+bool next_chunk_is_deflated(std::istream &from) {
+	char magic[4] = {'\0', '\0', '\0', '\0'};
+	std::streampos at = from.tellg();
+	bool read = bool(from.read(magic, 4));
+	from.clear();
+	from.seekg(at);
+	return read && std::string(magic, 4) == "zlib";
+}
+
+void read_deflated_chunk(std::istream &from, std::string const &magic, size_t element_size, DeflatedChunk *to_) {
+	assert(to_);
+	auto &to = *to_;
+
+	DeflateHeader header;
+	if (!from.read(reinterpret_cast< char * >(&header), sizeof(header))) {
+		throw std::runtime_error("Failed to read chunk header");
+	}
+	if (std::string(header.magic, 4) != "zlib" || std::string(header.wrapped_magic, 4) != magic) {
+		throw std::runtime_error("Unexpected magic number in chunk");
+	}
+	if (header.size < 8) {
+		throw std::runtime_error("Compressed chunk is too small for its header");
+	}
+	if (header.wrapped_size % element_size != 0) {
+		throw std::runtime_error("Size of chunk not divisible by element size");
+	}
+
+	to.size = header.wrapped_size;
+	to.compressed.resize(header.size - 8);
+	if (!from.read(to.compressed.data(), to.compressed.size())) {
+		throw std::runtime_error("Failed to read chunk data.");
+	}
+}
+
+//inflate a compressed chunk through a series of output blocks:
+// next_block() says where the next block of output goes (and how big it is); full() is called with how much of it
+// was filled, once it is full or the data ends.
+static void inflate_through(DeflatedChunk const &chunk, std::function< std::pair< char *, size_t >() > const &next_block, std::function< void(size_t got) > const &full) {
+	z_stream stream;
+	std::memset(&stream, 0, sizeof(stream));
+	if (inflateInit(&stream) != Z_OK) {
+		throw std::runtime_error("Failed to initialize zlib");
+	}
+	//(zlib counts in 32-bit unsigned ints, so very large chunks are fed in pieces)
+	constexpr size_t MaxIn = std::numeric_limits< uInt >::max();
+	char const *in = chunk.compressed.data();
+	size_t in_left = chunk.compressed.size();
+
+	size_t produced = 0;
+	int ret = Z_OK;
+	while (ret != Z_STREAM_END) {
+		std::pair< char *, size_t > block = next_block();
+		assert(block.second > 0 && block.second <= MaxIn);
+		stream.next_out = reinterpret_cast< Bytef * >(block.first);
+		stream.avail_out = uInt(block.second);
+		//fill the block (or finish the stream):
+		while (stream.avail_out > 0 && ret != Z_STREAM_END) {
+			if (stream.avail_in == 0 && in_left > 0) {
+				stream.next_in = reinterpret_cast< Bytef * >(const_cast< char * >(in));
+				stream.avail_in = uInt(std::min(in_left, MaxIn));
+				in += stream.avail_in;
+				in_left -= stream.avail_in;
+			}
+			ret = inflate(&stream, Z_NO_FLUSH);
+			if (ret == Z_BUF_ERROR && stream.avail_in == 0 && in_left == 0) ret = Z_DATA_ERROR; //(ran out of input)
+			if (ret != Z_OK && ret != Z_STREAM_END) {
+				inflateEnd(&stream);
+				throw std::runtime_error("Failed to inflate compressed chunk (zlib error " + std::to_string(ret) + ")");
+			}
+		}
+		size_t got = block.second - stream.avail_out;
+		produced += got;
+		if (produced > chunk.size) {
+			inflateEnd(&stream);
+			throw std::runtime_error("Compressed chunk is larger than its header says.");
+		}
+		full(got);
+	}
+	inflateEnd(&stream);
+
+	if (produced != chunk.size) {
+		throw std::runtime_error("Compressed chunk is smaller than its header says.");
+	}
+}
+
+void inflate_blocks(DeflatedChunk const &chunk, size_t block_size, std::function< void(char const *data, size_t size) > const &consume) {
+	assert(block_size > 0);
+	//(blocks are one byte bigger than the data when it all fits in one, so the end of the stream is seen in the same block)
+	std::vector< char > block(std::min(block_size, chunk.size + 1));
+	inflate_through(chunk, [&]() {
+		return std::make_pair(block.data(), block.size());
+	}, [&](size_t got) {
+		if (got) consume(block.data(), got);
+	});
+}
+
+void inflate_chunk(DeflatedChunk const &chunk, void *to) {
+	//inflate straight into place, checking with a spare byte past the end that there's nothing extra:
+	constexpr size_t MaxOut = std::numeric_limits< uInt >::max();
+	char *at = reinterpret_cast< char * >(to);
+	char *end = at + chunk.size;
+	char spare = 0;
+	inflate_through(chunk, [&]() {
+		if (at == end) return std::make_pair(&spare, size_t(1));
+		return std::make_pair(at, std::min(size_t(end - at), MaxOut));
+	}, [&](size_t got) {
+		if (at != end) at += got;
+	});
+}
+
+void write_deflated_chunk(std::string const &magic, void const *data, size_t size, std::ostream *to_, int level) {
+	assert(magic.size() == 4);
+	assert(to_);
+	auto &to = *to_;
+
+	if (size > std::numeric_limits< uint32_t >::max() || size > std::numeric_limits< uLong >::max()) {
+		throw std::runtime_error("Chunk is too large to compress.");
+	}
+
+	uLongf compressed_size = compressBound(uLong(size));
+	std::vector< char > compressed(compressed_size);
+	int ret = compress2(reinterpret_cast< Bytef * >(compressed.data()), &compressed_size,
+		reinterpret_cast< Bytef const * >(data), uLong(size), level);
+	if (ret != Z_OK) {
+		throw std::runtime_error("Failed to compress chunk (zlib error " + std::to_string(ret) + ")");
+	}
+	compressed.resize(compressed_size);
+
+	DeflateHeader header;
+	header.size = uint32_t(8 + compressed.size());
+	std::memcpy(header.wrapped_magic, magic.data(), 4);
+	header.wrapped_size = uint32_t(size);
+
+	to.write(reinterpret_cast< char const * >(&header), sizeof(header));
+	to.write(compressed.data(), compressed.size());
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+/*
+ * Deflate-compressed chunks (compressed with the zlib that is linked for libpng).
+ *
+ * A compressed chunk wraps an ordinary chunk (see read_write_chunk.hpp) in a 'zlib' chunk:
+ * |zl|ib|..|..| <-- magic number "zlib"
+ * |sz|sz|sz|sz| <-- four byte (native endian) size of the rest of the chunk
+ * |ma|gi|c.|..| <-- magic number of the wrapped chunk
+ * |us|us|us|us| <-- four byte (native endian) size of the wrapped chunk's data, uncompressed
+ * |zz...zz| <-- the wrapped chunk's data, as a zlib stream
+ *
+ * Readers that accept compressed chunks check for the wrapper with
+ * next_chunk_is_deflated() and otherwise read chunks as usual, so files can
+ * mix compressed and uncompressed chunks.
+ *
+ * Compressed data can be inflated in fixed-size blocks (e.g., to convert it
+ * on the way into a mapped OpenGL buffer) without inflating all of it first.
+ *
+ */
+
+#include "read_write_chunk.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//a compressed chunk, still compressed:
+struct DeflatedChunk {
+	std::vector< char > compressed; //zlib stream
+	size_t size = 0; //size of the wrapped chunk's data, uncompressed
+};
+
+//is the next chunk in 'from' a compressed chunk? (doesn't move the read position)
+bool next_chunk_is_deflated(std::istream &from);
+
+//read a compressed chunk wrapping a 'magic' chunk, leaving its data compressed:
+// (like read_chunk, throws if the chunk doesn't match or its size isn't a multiple of 'element_size')
+void read_deflated_chunk(std::istream &from, std::string const &magic, size_t element_size, DeflatedChunk *to);
+
+//inflate a compressed chunk, handing its data to 'consume' in order:
+// every block but the last is exactly 'block_size' bytes (so blocks hold whole elements if 'block_size' is a multiple of the element size)
+// throws if the data is corrupt or isn't the size the chunk says
+void inflate_blocks(DeflatedChunk const &chunk, size_t block_size, std::function< void(char const *data, size_t size) > const &consume);
+
+//..or all at once, into chunk.size bytes at 'to':
+void inflate_chunk(DeflatedChunk const &chunk, void *to);
+
+//write 'size' bytes at 'data' as a compressed chunk wrapping a 'magic' chunk:
+// (level is a zlib compression level, 1 (fastest) .. 9 (smallest))
+void write_deflated_chunk(std::string const &magic, void const *data, size_t size, std::ostream *to, int level = 9);
+
+template< typename T >
+void write_deflated_chunk(std::string const &magic, std::vector< T > const &from, std::ostream *to, int level = 9) {
+	write_deflated_chunk(magic, from.data(), from.size() * sizeof(T), to, level);
+}
+
+//read a chunk that may or may not be compressed (inflating it if it is):
+template< typename T >
+void read_chunk_maybe_deflated(std::istream &from, std::string const &magic, std::vector< T > *to_) {
+	if (!next_chunk_is_deflated(from)) {
+		read_chunk(from, magic, to_);
+		return;
+	}
+	assert(to_);
+	auto &to = *to_;
+	DeflatedChunk chunk;
+	read_deflated_chunk(from, magic, sizeof(T), &chunk);
+	to.resize(chunk.size / sizeof(T));
+	inflate_chunk(chunk, to.data());
+}
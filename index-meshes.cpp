@@ -0,0 +1,262 @@
+//index-meshes converts a .pnct file (triangle soup: every corner of every triangle stored as its own vertex)
+// into an indexed .ipnct file, welding corners with identical attributes into one vertex.
+//
+// Usage:
+//   index-meshes [--no-optimize] [--overdraw] [--deflate] <in.pnct> <out.ipnct>
+//
+// Unless --no-optimize is given, each mesh's triangles are then reordered for the
+// post-transform vertex cache (and, with --overdraw, so outward-facing clusters come first)
+// and its vertices renumbered in order of use; see mesh_optimize.hpp.
+// A per-mesh report of vertex cache efficiency (ACMR/ATVR with a 16-entry FIFO cache) is printed.
+// With --deflate, every chunk is written compressed (see deflate_chunk.hpp).
+// (The input may have compressed chunks, too.)
+//
+// .ipnct files contain:
+//   pnct chunk: welded vertices (same 'Vertex' format as .pnct files)
+//   ix16 or ix32 chunk: indices (16-bit if every mesh has at most 65536 vertices), relative to each mesh's first vertex
+//   str0 chunk: mesh names
+//   idx1 chunk: per-mesh name, vertex, and index ranges
+//   bnd0 chunk: per-mesh bounding box and bounding sphere radius (around the box's center), in the same order as idx1
+//     (MeshBuffer uses these rather than finding bounds as it loads; the sphere is exact, which it couldn't be in one pass)
+// Each mesh's vertices are welded separately, so meshes keep contiguous vertex ranges
+// (which is what lets 16-bit indices be used with glDrawElementsBaseVertex in buffers with many vertices).
+
+#include "read_write_chunk.hpp"
+#include "deflate_chunk.hpp"
+#include "mesh_optimize.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+//vertex format of .pnct (and .ipnct) files:
+struct Vertex {
+	glm::vec3 Position;
+	glm::vec3 Normal;
+	glm::u8vec4 Color;
+	glm::vec2 TexCoord;
+};
+static_assert(sizeof(Vertex) == 3*4+3*4+4*1+2*4, "Vertex is packed.");
+
+//vertices are welded only if all their bytes match (so, e.g., -0.0f and 0.0f stay separate):
+struct VertexHash {
+	size_t operator()(Vertex const &v) const {
+		//FNV-1a over the vertex's bytes:
+		unsigned char const *bytes = reinterpret_cast< unsigned char const * >(&v);
+		uint64_t hash = 0xcbf29ce484222325ULL;
+		for (size_t i = 0; i < sizeof(Vertex); ++i) {
+			hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+		}
+		return size_t(hash);
+	}
+};
+struct VertexEqual {
+	bool operator()(Vertex const &a, Vertex const &b) const {
+		return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+	}
+};
+
+int main(int argc, char **argv) {
+	bool optimize = true;
+	bool overdraw = false;
+	bool deflate = false;
+	std::vector< std::string > filenames;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--no-optimize") {
+			optimize = false;
+		} else if (arg == "--overdraw") {
+			overdraw = true;
+		} else if (arg == "--deflate") {
+			deflate = true;
+		} else {
+			filenames.emplace_back(arg);
+		}
+	}
+	if (filenames.size() != 2) {
+		std::cerr << "Usage:\n\t" << argv[0] << " [--no-optimize] [--overdraw] [--deflate] <in.pnct> <out.ipnct>" << std::endl;
+		return 1;
+	}
+	std::string in_filename = filenames[0];
+	std::string out_filename = filenames[1];
+
+	try {
+		//--- read .pnct file ---
+		std::ifstream in(in_filename, std::ios::binary);
+		if (!in) throw std::runtime_error("Failed to open '" + in_filename + "'.");
+
+		std::vector< Vertex > soup;
+		read_chunk_maybe_deflated(in, "pnct", &soup);
+
+		std::vector< char > strings;
+		read_chunk_maybe_deflated(in, "str0", &strings);
+
+		struct IndexEntry {
+			uint32_t name_begin, name_end;
+			uint32_t vertex_begin, vertex_end;
+		};
+		static_assert(sizeof(IndexEntry) == 16, "Index entry should be packed");
+		std::vector< IndexEntry > index;
+		read_chunk_maybe_deflated(in, "idx0", &index);
+
+		if (in.peek() != EOF) {
+			std::cerr << "WARNING: trailing data in mesh file '" << in_filename << "'" << std::endl;
+		}
+
+		//--- weld (and optimize) each mesh's vertices ---
+		struct IndexedEntry {
+			uint32_t name_begin, name_end;
+			uint32_t vertex_begin, vertex_end;
+			uint32_t index_begin, index_end;
+		};
+		static_assert(sizeof(IndexedEntry) == 24, "Indexed entry should be packed");
+		std::vector< IndexedEntry > indexed;
+
+		std::vector< Vertex > vertices;
+		std::vector< uint32_t > indices;
+		uint32_t max_mesh_vertices = 0;
+
+		//meshes that share a vertex range (e.g., duplicated names) share welded data:
+		std::map< std::pair< uint32_t, uint32_t >, IndexedEntry > welded;
+
+		for (auto const &entry : index) {
+			if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
+				throw std::runtime_error("index entry has out-of-range name begin/end");
+			}
+			if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= soup.size())) {
+				throw std::runtime_error("index entry has out-of-range vertex start/count");
+			}
+
+			auto range = std::make_pair(entry.vertex_begin, entry.vertex_end);
+			auto f = welded.find(range);
+			if (f == welded.end()) {
+				std::string name(strings.begin() + entry.name_begin, strings.begin() + entry.name_end);
+
+				//weld:
+				std::vector< Vertex > mesh_vertices;
+				std::vector< uint32_t > mesh_indices;
+				std::unordered_map< Vertex, uint32_t, VertexHash, VertexEqual > seen;
+				seen.reserve(entry.vertex_end - entry.vertex_begin);
+				for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
+					auto ret = seen.emplace(soup[v], uint32_t(mesh_vertices.size()));
+					if (ret.second) mesh_vertices.emplace_back(soup[v]);
+					mesh_indices.emplace_back(ret.first->second);
+				}
+				mesh_indices.resize(mesh_indices.size() / 3 * 3); //(.pnct meshes are triangles, but just in case)
+
+				//optimize:
+				VertexCacheStats before = analyze_vertex_cache(mesh_indices, uint32_t(mesh_vertices.size()));
+				if (optimize) {
+					optimize_vertex_cache(&mesh_indices, uint32_t(mesh_vertices.size()));
+					if (overdraw) {
+						std::vector< glm::vec3 > positions;
+						positions.reserve(mesh_vertices.size());
+						for (auto const &v : mesh_vertices) positions.emplace_back(v.Position);
+						optimize_overdraw(&mesh_indices, positions);
+					}
+					std::vector< uint32_t > remap = optimize_vertex_fetch(&mesh_indices, uint32_t(mesh_vertices.size()));
+					std::vector< Vertex > fetch_ordered;
+					fetch_ordered.reserve(remap.size());
+					for (uint32_t v : remap) fetch_ordered.emplace_back(mesh_vertices[v]);
+					mesh_vertices = std::move(fetch_ordered);
+				}
+				VertexCacheStats after = analyze_vertex_cache(mesh_indices, uint32_t(mesh_vertices.size()));
+
+				std::cout << "  " << std::left << std::setw(24) << name << std::right
+				          << std::setw(8) << mesh_indices.size() / 3 << " tris " << std::setw(8) << mesh_vertices.size() << " verts"
+				          << std::fixed << std::setprecision(3)
+				          << "  ACMR " << before.acmr << " -> " << after.acmr
+				          << "  ATVR " << before.atvr << " -> " << after.atvr
+				          << std::defaultfloat << std::endl;
+
+				IndexedEntry out;
+				out.vertex_begin = uint32_t(vertices.size());
+				out.index_begin = uint32_t(indices.size());
+				vertices.insert(vertices.end(), mesh_vertices.begin(), mesh_vertices.end());
+				indices.insert(indices.end(), mesh_indices.begin(), mesh_indices.end());
+				out.vertex_end = uint32_t(vertices.size());
+				out.index_end = uint32_t(indices.size());
+				max_mesh_vertices = std::max(max_mesh_vertices, out.vertex_end - out.vertex_begin);
+				f = welded.emplace(range, out).first;
+			}
+
+			IndexedEntry out = f->second;
+			out.name_begin = entry.name_begin;
+			out.name_end = entry.name_end;
+			indexed.emplace_back(out);
+		}
+
+		//--- find each mesh's bounds ---
+		struct BoundsEntry {
+			glm::vec3 min, max;
+			float radius; //of a sphere around (min + max) / 2
+		};
+		static_assert(sizeof(BoundsEntry) == 28, "Bounds entry should be packed");
+		std::vector< BoundsEntry > bounds;
+		bounds.reserve(indexed.size());
+		for (auto const &entry : indexed) {
+			BoundsEntry b;
+			b.min = glm::vec3( std::numeric_limits< float >::infinity());
+			b.max = glm::vec3(-std::numeric_limits< float >::infinity());
+			b.radius = 0.0f;
+			for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
+				b.min = glm::min(b.min, vertices[v].Position);
+				b.max = glm::max(b.max, vertices[v].Position);
+			}
+			glm::vec3 center = 0.5f * (b.min + b.max);
+			for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
+				b.radius = std::max(b.radius, glm::length(vertices[v].Position - center));
+			}
+			bounds.emplace_back(b);
+		}
+
+		//--- write .ipnct file ---
+		std::ofstream out(out_filename, std::ios::binary);
+		if (!out) throw std::runtime_error("Failed to open '" + out_filename + "' for writing.");
+
+		auto write = [&](std::string const &magic, auto const &data) {
+			if (deflate) write_deflated_chunk(magic, data, &out);
+			else write_chunk(magic, data, &out);
+		};
+		write("pnct", vertices);
+		if (max_mesh_vertices <= 0x10000) {
+			std::vector< uint16_t > indices16(indices.begin(), indices.end());
+			write("ix16", indices16);
+		} else {
+			write("ix32", indices);
+		}
+		write("str0", strings);
+		write("idx1", indexed);
+		write("bnd0", bounds);
+
+		if (!out) throw std::runtime_error("Failed to write '" + out_filename + "'.");
+		size_t file_size = size_t(out.tellp());
+
+		//--- report ---
+		size_t index_size = (max_mesh_vertices <= 0x10000 ? 2 : 4);
+		size_t before = soup.size() * sizeof(Vertex);
+		size_t after = vertices.size() * sizeof(Vertex) + indices.size() * index_size;
+		std::cout << "Welded " << soup.size() << " vertices into " << vertices.size()
+		          << " (" << indices.size() << " " << (index_size * 8) << "-bit indices) in " << indexed.size() << " meshes; "
+		          << before << " bytes -> " << after << " bytes";
+		if (deflate) std::cout << " (" << file_size << " bytes in file, compressed)";
+		std::cout << "." << std::endl;
+	} catch (std::exception &e) {
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
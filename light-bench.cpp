@@ -0,0 +1,320 @@
+//light-bench renders a grid of blocks lit by many point lights, offscreen, and reports
+// how long frames take with per-object light lists vs. the clustered light grid.
+// Per-object light lists only use the first Scene::MaxLights lights, so both pipelines are first timed
+// with that many lights (the same ones), and then the clustered grid is timed with all of them.
+//
+// By default it asks for a software OpenGL implementation (Mesa's llvmpipe) so that numbers
+// are comparable between machines; pass --hardware to use the usual driver instead.
+// On machines without a display, run with SDL_VIDEODRIVER=offscreen.
+
+#include "Scene.hpp"
+#include "LightGrid.hpp"
+#include "LitColorTextureProgram.hpp"
+#include "Load.hpp"
+#include "GL.hpp"
+#include "gl_errors.hpp"
+
+#include <SDL.h>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//vertex format matching the attributes of lit_color_texture_program:
+struct Vertex {
+	glm::vec3 Position;
+	glm::vec3 Normal;
+	glm::u8vec4 Color;
+	glm::vec2 TexCoord;
+};
+
+//vertices for a unit cube, as triangles:
+static std::vector< Vertex > make_cube() {
+	std::vector< Vertex > ret;
+	for (uint32_t axis = 0; axis < 3; ++axis) {
+		for (float sign : {-1.0f, 1.0f}) {
+			glm::vec3 n = glm::vec3(0.0f); n[axis] = sign;
+			glm::vec3 u = glm::vec3(0.0f); u[(axis + 1) % 3] = 1.0f;
+			glm::vec3 v = glm::cross(n, u);
+			glm::vec3 c[4] = { 0.5f * (n - u - v), 0.5f * (n + u - v), 0.5f * (n + u + v), 0.5f * (n - u + v) };
+			for (uint32_t i : {0, 1, 2, 0, 2, 3}) {
+				ret.emplace_back(Vertex{c[i], n, glm::u8vec4(0xdd, 0xdd, 0xdd, 0xff), glm::vec2(0.0f)});
+			}
+		}
+	}
+	return ret;
+}
+
+//vertex array object that reads 'buffer' (of Vertex) for 'program':
+static GLuint make_vao(GLuint buffer, LitColorTextureProgram const &program) {
+	GLuint vao = 0;
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	auto attrib = [](GLuint location, GLint size, GLenum type, GLboolean normalized, size_t offset) {
+		if (location == -1U) return;
+		glVertexAttribPointer(location, size, type, normalized, sizeof(Vertex), (GLbyte *)0 + offset);
+		glEnableVertexAttribArray(location);
+	};
+	attrib(program.Position_vec4, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Position));
+	attrib(program.Normal_vec3, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Normal));
+	attrib(program.Color_vec4, 4, GL_UNSIGNED_BYTE, GL_TRUE, offsetof(Vertex, Color));
+	attrib(program.TexCoord_vec2, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, TexCoord));
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+	return vao;
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	//when compiled on windows, unhandled exceptions don't have their message printed, which can make debugging simple issues difficult.
+	try {
+#endif
+
+	//------------ command line ------------
+	uint32_t light_count = 1000;
+	uint32_t frames = 60;
+	bool hardware = false;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--lights" && i + 1 < argc) {
+			light_count = uint32_t(std::stoul(argv[++i]));
+		} else if (arg == "--frames" && i + 1 < argc) {
+			frames = std::max(1U, uint32_t(std::stoul(argv[++i])));
+		} else if (arg == "--hardware") {
+			hardware = true;
+		} else {
+			std::cerr << "Usage:\n\t" << argv[0] << " [--lights N] [--frames N] [--hardware]" << std::endl;
+			return 1;
+		}
+	}
+
+	//------------  initialization ------------
+
+	//ask Mesa for its software rasterizer (has to happen before the GL library is loaded):
+	if (!hardware) SDL_setenv("LIBGL_ALWAYS_SOFTWARE", "1", 1);
+
+	SDL_Init(SDL_INIT_VIDEO);
+
+	SDL_GL_ResetAttributes();
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+
+	//a hidden window, just to have somewhere to make a context:
+	SDL_Window *window = SDL_CreateWindow("light-bench", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 64, 64, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+	if (!window) {
+		std::cerr << "Error creating SDL window: " << SDL_GetError() << std::endl;
+		return 1;
+	}
+
+	SDL_GLContext context = SDL_GL_CreateContext(window);
+	if (!context) {
+		SDL_DestroyWindow(window);
+		std::cerr << "Error creating OpenGL context: " << SDL_GetError() << std::endl;
+		return 1;
+	}
+
+	init_GL();
+
+	std::cout << "Renderer: " << (char const *)glGetString(GL_RENDERER) << std::endl;
+
+	call_load_functions();
+
+	//render into a framebuffer of fixed size (the window is never shown):
+	glm::uvec2 drawable_size = glm::uvec2(1280, 720);
+	GLuint fb = 0, color_rb = 0, depth_rb = 0;
+	glGenRenderbuffers(1, &color_rb);
+	glBindRenderbuffer(GL_RENDERBUFFER, color_rb);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, drawable_size.x, drawable_size.y);
+	glGenRenderbuffers(1, &depth_rb);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth_rb);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, drawable_size.x, drawable_size.y);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glGenFramebuffers(1, &fb);
+	glBindFramebuffer(GL_FRAMEBUFFER, fb);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_rb);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_rb);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		throw std::runtime_error("Offscreen framebuffer is incomplete.");
+	}
+	glViewport(0, 0, drawable_size.x, drawable_size.y);
+
+	//------------ benchmark scene ------------
+
+	std::vector< Vertex > cube = make_cube();
+	GLuint buffer = 0;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, cube.size() * sizeof(Vertex), cube.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	//a 32x32 grid of blocks, 'lights' point lights scattered just above it, and a camera looking down at it all:
+	// (made the same way -- with the same random lights, of which fewer lights are a prefix -- for each pipeline being compared)
+	auto make_scene = [&](Scene *scene, Scene::Drawable::Pipeline const &pipeline, GLuint vao, uint32_t lights) {
+		constexpr int32_t Blocks = 32;
+		constexpr float Spacing = 2.0f;
+		for (int32_t y = 0; y < Blocks; ++y) {
+			for (int32_t x = 0; x < Blocks; ++x) {
+				scene->transforms.emplace_back();
+				Scene::Transform &transform = scene->transforms.back();
+				transform.position = glm::vec3((x - 0.5f * Blocks) * Spacing, (y - 0.5f * Blocks) * Spacing, 0.0f);
+				transform.scale = glm::vec3(0.8f * Spacing, 0.8f * Spacing, 0.5f);
+
+				scene->drawables.emplace_back(&transform);
+				Scene::Drawable &drawable = scene->drawables.back();
+				drawable.pipeline = pipeline;
+				drawable.pipeline.vao = vao;
+				drawable.pipeline.instanced = Scene::Drawable::Pipeline::Instanced(); //(compare lighting, not instancing)
+				drawable.pipeline.type = GL_TRIANGLES;
+				drawable.pipeline.start = 0;
+				drawable.pipeline.count = GLuint(cube.size());
+				drawable.bounds_min = glm::vec3(-0.5f);
+				drawable.bounds_max = glm::vec3( 0.5f);
+			}
+		}
+
+		std::mt19937 mt(0x15466);
+		std::uniform_real_distribution< float > across(-0.5f * Blocks * Spacing, 0.5f * Blocks * Spacing);
+		std::uniform_real_distribution< float > height(0.5f, 2.0f);
+		std::uniform_real_distribution< float > tint(0.2f, 1.0f);
+		for (uint32_t i = 0; i < lights; ++i) {
+			scene->transforms.emplace_back();
+			Scene::Transform &transform = scene->transforms.back();
+			//(separate statements, since the order function arguments are evaluated in isn't specified)
+			float x = across(mt);
+			float y = across(mt);
+			float z = height(mt);
+			transform.position = glm::vec3(x, y, z);
+
+			scene->lights.emplace_back(&transform);
+			Scene::Light &light = scene->lights.back();
+			light.type = Scene::Light::Point;
+			float r = tint(mt);
+			float g = tint(mt);
+			float b = tint(mt);
+			light.energy = 4.0f * glm::vec3(r, g, b);
+			light.distance = 3.0f;
+		}
+
+		scene->transforms.emplace_back();
+		Scene::Transform &camera_transform = scene->transforms.back();
+		camera_transform.position = glm::vec3(0.0f, -45.0f, 30.0f);
+		camera_transform.rotation = glm::angleAxis(std::atan2(45.0f, 30.0f), glm::vec3(1.0f, 0.0f, 0.0f)); //look toward the origin
+		scene->cameras.emplace_back(&camera_transform);
+		scene->cameras.back().aspect = float(drawable_size.x) / float(drawable_size.y);
+
+		scene->compile();
+	};
+
+	//------------ run ------------
+	{ //(scope so that the light grid is cleaned up while the context still exists)
+
+	LightGrid light_grid;
+
+	auto run = [&](std::string const &name, Scene const &scene, bool clustered) {
+		Scene::Camera const &camera = scene.cameras.front();
+
+		float grid_seconds = 0.0f;
+		auto frame = [&]() {
+			glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glEnable(GL_DEPTH_TEST);
+			glDepthFunc(GL_LESS);
+
+			if (clustered) {
+				auto before = std::chrono::high_resolution_clock::now();
+				light_grid.update(scene, camera, drawable_size);
+				grid_seconds += std::chrono::duration< float >(std::chrono::high_resolution_clock::now() - before).count();
+				light_grid.bind();
+			}
+			scene.draw(camera);
+			if (clustered) light_grid.unbind();
+		};
+
+		//warm up (shader compilation, buffer allocation, ...):
+		for (uint32_t i = 0; i < 3; ++i) frame();
+		glFinish();
+		grid_seconds = 0.0f;
+
+		auto before = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < frames; ++i) frame();
+		glFinish();
+		float seconds = std::chrono::duration< float >(std::chrono::high_resolution_clock::now() - before).count();
+
+		std::cout << name << ": " << (seconds / frames * 1000.0f) << " ms/frame";
+		if (clustered) {
+			std::cout << " (light grid: " << (grid_seconds / frames * 1000.0f) << " ms/frame; "
+				<< light_grid.stats.visible_lights << " of " << light_grid.stats.lights << " lights visible, "
+				<< light_grid.stats.cluster_lights << " cluster entries, at most " << light_grid.stats.max_cluster_lights << " per cluster)";
+		} else {
+			std::cout << " (" << scene.draw_stats.lights << " lights used, " << scene.draw_stats.object_lights << " object-light pairs)";
+		}
+		std::cout << std::endl;
+		GL_ERRORS();
+	};
+
+	std::cout << "Drawing 1024 blocks lit by " << light_count << " point lights, " << frames << " frames at "
+		<< drawable_size.x << "x" << drawable_size.y << "." << std::endl;
+
+	auto run_per_object = [&](uint32_t lights) {
+		GLuint vao = make_vao(buffer, *lit_color_texture_program);
+		Scene scene;
+		make_scene(&scene, lit_color_texture_program_pipeline, vao, lights);
+		run("  per-object light lists", scene, false);
+		glDeleteVertexArrays(1, &vao);
+	};
+	auto run_clustered = [&](uint32_t lights) {
+		GLuint vao = make_vao(buffer, *lit_color_texture_clustered_program);
+		Scene scene;
+		make_scene(&scene, lit_color_texture_clustered_program_pipeline, vao, lights);
+		run("  clustered light grid", scene, true);
+		glDeleteVertexArrays(1, &vao);
+	};
+
+	//the same lights for both pipelines (per-object lists can't use more than MaxLights):
+	uint32_t shared_lights = std::min(light_count, uint32_t(Scene::MaxLights));
+	std::cout << "With the same " << shared_lights << " lights (the most per-object light lists can use):" << std::endl;
+	run_per_object(shared_lights);
+	run_clustered(shared_lights);
+
+	//..and with all of them, which only the clustered grid can draw:
+	if (light_count > shared_lights) {
+		std::cout << "With all " << light_count << " lights:" << std::endl;
+		run_clustered(light_count);
+	}
+
+	} //end of light grid scope
+
+	//------------  teardown ------------
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fb);
+	glDeleteRenderbuffers(1, &color_rb);
+	glDeleteRenderbuffers(1, &depth_rb);
+	glDeleteBuffers(1, &buffer);
+
+	SDL_GL_DeleteContext(context);
+	context = 0;
+
+	SDL_DestroyWindow(window);
+	window = NULL;
+
+	return 0;
+
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}
@@ -0,0 +1,267 @@
+#include "mesh_optimize.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+//---------------------------------------------
+//vertex cache ordering (after Forsyth):
+
+//size of the (LRU) cache that scores are computed for:
+static constexpr uint32_t ScoreCacheSize = 32;
+
+//how much a vertex is worth using next, given its position in the cache (-1 => not in cache) and how many unused triangles it has left:
+static float vertex_score(int32_t cache_position, uint32_t live_triangles) {
+	if (live_triangles == 0) return -1.0f; //(nothing left to draw with this vertex)
+
+	float score = 0.0f;
+	if (cache_position >= 0) {
+		if (cache_position < 3) {
+			//the vertices of the last triangle are slightly penalized, so strips don't just continue in one direction:
+			score = 0.75f;
+		} else {
+			float scale = 1.0f / float(ScoreCacheSize - 3);
+			score = std::pow(1.0f - float(cache_position - 3) * scale, 1.5f);
+		}
+	}
+	//vertices with few triangles left get a boost, so they are finished off (rather than left behind):
+	score += 2.0f / std::sqrt(float(live_triangles));
+	return score;
+}
+
+void optimize_vertex_cache(std::vector< uint32_t > *indices_, uint32_t vertex_count) {
+	assert(indices_);
+	auto &indices = *indices_;
+	assert(indices.size() % 3 == 0);
+
+	uint32_t triangle_count = uint32_t(indices.size() / 3);
+	if (triangle_count == 0) return;
+
+	//triangles using each vertex (the first 'live' entries in each vertex's range are the unused ones):
+	std::vector< uint32_t > live(vertex_count, 0);
+	for (uint32_t i : indices) {
+		assert(i < vertex_count);
+		live[i] += 1;
+	}
+	std::vector< uint32_t > adjacency_begin(vertex_count + 1, 0);
+	for (uint32_t v = 0; v < vertex_count; ++v) {
+		adjacency_begin[v + 1] = adjacency_begin[v] + live[v];
+	}
+	std::vector< uint32_t > adjacency(indices.size());
+	{
+		std::vector< uint32_t > filled(vertex_count, 0);
+		for (uint32_t t = 0; t < triangle_count; ++t) {
+			for (uint32_t c = 0; c < 3; ++c) {
+				uint32_t v = indices[3 * t + c];
+				adjacency[adjacency_begin[v] + filled[v]] = t;
+				filled[v] += 1;
+			}
+		}
+	}
+
+	std::vector< int32_t > cache_position(vertex_count, -1);
+	std::vector< float > score(vertex_count);
+	for (uint32_t v = 0; v < vertex_count; ++v) {
+		score[v] = vertex_score(-1, live[v]);
+	}
+
+	std::vector< float > triangle_score(triangle_count);
+	std::vector< bool > emitted(triangle_count, false);
+	for (uint32_t t = 0; t < triangle_count; ++t) {
+		triangle_score[t] = score[indices[3 * t + 0]] + score[indices[3 * t + 1]] + score[indices[3 * t + 2]];
+	}
+
+	std::vector< uint32_t > cache, next_cache;
+	cache.reserve(ScoreCacheSize + 3);
+	next_cache.reserve(ScoreCacheSize + 3);
+
+	std::vector< uint32_t > ordered;
+	ordered.reserve(indices.size());
+
+	uint32_t best = -1U;
+	for (uint32_t emitted_count = 0; emitted_count < triangle_count; ++emitted_count) {
+		if (best == -1U) {
+			//nothing in the cache is worth continuing with, so start over from the best triangle anywhere:
+			// (this happens about once per connected piece of the mesh)
+			float best_score = -1.0f;
+			for (uint32_t t = 0; t < triangle_count; ++t) {
+				if (!emitted[t] && triangle_score[t] > best_score) {
+					best_score = triangle_score[t];
+					best = t;
+				}
+			}
+			assert(best != -1U);
+		}
+
+		//emit the triangle:
+		uint32_t const *tri = &indices[3 * best];
+		ordered.insert(ordered.end(), tri, tri + 3);
+		emitted[best] = true;
+
+		//remove it from its vertices' unused triangles:
+		for (uint32_t c = 0; c < 3; ++c) {
+			uint32_t v = tri[c];
+			uint32_t *begin = &adjacency[adjacency_begin[v]];
+			uint32_t *end = begin + live[v];
+			uint32_t *at = std::find(begin, end, best);
+			assert(at != end);
+			std::swap(*at, *(end - 1));
+			live[v] -= 1;
+		}
+
+		//move its vertices to the front of the cache:
+		next_cache.assign(tri, tri + 3);
+		for (uint32_t v : cache) {
+			if (v != tri[0] && v != tri[1] && v != tri[2]) next_cache.emplace_back(v);
+		}
+		std::swap(cache, next_cache);
+
+		//update scores of vertices in (or just pushed out of) the cache, and of their unused triangles:
+		for (uint32_t i = 0; i < cache.size(); ++i) {
+			uint32_t v = cache[i];
+			cache_position[v] = (i < ScoreCacheSize ? int32_t(i) : -1);
+			score[v] = vertex_score(cache_position[v], live[v]);
+		}
+		best = -1U;
+		float best_score = -1.0f;
+		for (uint32_t v : cache) {
+			for (uint32_t a = adjacency_begin[v]; a < adjacency_begin[v] + live[v]; ++a) {
+				uint32_t t = adjacency[a];
+				triangle_score[t] = score[indices[3 * t + 0]] + score[indices[3 * t + 1]] + score[indices[3 * t + 2]];
+				if (triangle_score[t] > best_score) {
+					best_score = triangle_score[t];
+					best = t;
+				}
+			}
+		}
+		if (cache.size() > ScoreCacheSize) cache.resize(ScoreCacheSize);
+	}
+
+	assert(ordered.size() == indices.size());
+	indices = std::move(ordered);
+}
+
+//---------------------------------------------
+//overdraw ordering:
+
+void optimize_overdraw(std::vector< uint32_t > *indices_, std::vector< glm::vec3 > const &positions) {
+	assert(indices_);
+	auto &indices = *indices_;
+	assert(indices.size() % 3 == 0);
+
+	uint32_t triangle_count = uint32_t(indices.size() / 3);
+	if (triangle_count == 0) return;
+
+	//split into clusters where the (simulated) cache starts over:
+	std::vector< uint32_t > cluster_begin;
+	{
+		constexpr uint32_t CacheSize = 16;
+		std::vector< uint32_t > entered(positions.size(), 0); //miss count just after each vertex entered the cache (0 => never)
+		uint32_t time = 0; //misses so far
+		for (uint32_t t = 0; t < triangle_count; ++t) {
+			uint32_t misses = 0;
+			for (uint32_t c = 0; c < 3; ++c) {
+				uint32_t v = indices[3 * t + c];
+				assert(v < positions.size());
+				if (entered[v] == 0 || time - entered[v] >= CacheSize) {
+					time += 1;
+					entered[v] = time;
+					misses += 1;
+				}
+			}
+			if (t == 0 || misses == 3) cluster_begin.emplace_back(t);
+		}
+	}
+	cluster_begin.emplace_back(triangle_count);
+	uint32_t cluster_count = uint32_t(cluster_begin.size() - 1);
+	if (cluster_count < 2) return;
+
+	//find the area-weighted center and normal of each cluster (and the center of the whole mesh):
+	std::vector< glm::vec3 > center(cluster_count, glm::vec3(0.0f));
+	std::vector< glm::vec3 > normal(cluster_count, glm::vec3(0.0f));
+	std::vector< float > area(cluster_count, 0.0f);
+	glm::vec3 mesh_center = glm::vec3(0.0f);
+	float mesh_area = 0.0f;
+	for (uint32_t c = 0; c < cluster_count; ++c) {
+		for (uint32_t t = cluster_begin[c]; t < cluster_begin[c + 1]; ++t) {
+			glm::vec3 const &a = positions[indices[3 * t + 0]];
+			glm::vec3 const &b = positions[indices[3 * t + 1]];
+			glm::vec3 const &d = positions[indices[3 * t + 2]];
+			glm::vec3 n = glm::cross(b - a, d - a); //(length is twice the area)
+			float twice_area = glm::length(n);
+			center[c] += (a + b + d) * (twice_area / 3.0f);
+			normal[c] += n;
+			area[c] += twice_area;
+		}
+		mesh_center += center[c];
+		mesh_area += area[c];
+	}
+	if (mesh_area > 0.0f) mesh_center /= mesh_area;
+
+	//clusters facing away from the center are likely to be in front of the rest of the mesh, so draw them first:
+	std::vector< float > facing(cluster_count, 0.0f);
+	for (uint32_t c = 0; c < cluster_count; ++c) {
+		if (area[c] == 0.0f) continue;
+		glm::vec3 n = normal[c];
+		float n_length = glm::length(n);
+		if (n_length == 0.0f) continue;
+		facing[c] = glm::dot(center[c] / area[c] - mesh_center, n / n_length);
+	}
+
+	std::vector< uint32_t > order(cluster_count);
+	for (uint32_t c = 0; c < cluster_count; ++c) order[c] = c;
+	std::stable_sort(order.begin(), order.end(), [&facing](uint32_t a, uint32_t b) {
+		return facing[a] > facing[b];
+	});
+
+	std::vector< uint32_t > ordered;
+	ordered.reserve(indices.size());
+	for (uint32_t c : order) {
+		ordered.insert(ordered.end(), indices.begin() + 3 * cluster_begin[c], indices.begin() + 3 * cluster_begin[c + 1]);
+	}
+	indices = std::move(ordered);
+}
+
+//---------------------------------------------
+//vertex fetch ordering:
+
+std::vector< uint32_t > optimize_vertex_fetch(std::vector< uint32_t > *indices_, uint32_t vertex_count) {
+	assert(indices_);
+	auto &indices = *indices_;
+
+	std::vector< uint32_t > new_index(vertex_count, -1U);
+	std::vector< uint32_t > remap;
+	for (uint32_t &i : indices) {
+		assert(i < vertex_count);
+		if (new_index[i] == -1U) {
+			new_index[i] = uint32_t(remap.size());
+			remap.emplace_back(i);
+		}
+		i = new_index[i];
+	}
+	return remap;
+}
+
+//---------------------------------------------
+//analysis:
+
+VertexCacheStats analyze_vertex_cache(std::vector< uint32_t > const &indices, uint32_t vertex_count, uint32_t cache_size) {
+	VertexCacheStats stats;
+	if (indices.empty()) return stats;
+
+	std::vector< uint32_t > entered(vertex_count, 0); //miss count just after each vertex entered the cache (0 => never)
+	uint32_t time = 0; //misses so far
+	uint32_t used = 0;
+	for (uint32_t v : indices) {
+		assert(v < vertex_count);
+		if (entered[v] == 0) used += 1;
+		if (entered[v] == 0 || time - entered[v] >= cache_size) {
+			time += 1;
+			entered[v] = time;
+		}
+	}
+
+	stats.acmr = float(time) / float(indices.size() / 3);
+	stats.atvr = float(time) / float(used);
+	return stats;
+}
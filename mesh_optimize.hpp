@@ -0,0 +1,44 @@
+#pragma once
+
+/*
+ * Offline reordering of indexed triangle meshes (used by index-meshes):
+ *
+ *  optimize_vertex_cache reorders triangles so that recently-transformed vertices
+ *   are reused (Tom Forsyth's "Linear-Speed Vertex Cache Optimisation").
+ *  optimize_overdraw then reorders clusters of those triangles so that ones facing
+ *   out from the mesh's center come first, which tends to reduce overdraw
+ *   (a simplified form of Sander et al.'s "Fast Triangle Reordering").
+ *  optimize_vertex_fetch renumbers vertices in order of first use, so vertex
+ *   fetches walk through memory in order.
+ *
+ *  analyze_vertex_cache reports how well a triangle order uses a FIFO vertex cache.
+ *
+ * All functions work on triangle lists (three indices per triangle).
+ *
+ */
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+//reorder triangles for vertex cache reuse:
+// 'vertex_count' must be greater than every index
+void optimize_vertex_cache(std::vector< uint32_t > *indices, uint32_t vertex_count);
+
+//reorder clusters of (vertex cache optimized) triangles, outward-facing clusters first:
+// clusters break where a triangle's vertices all miss the cache, so cache use is barely changed
+void optimize_overdraw(std::vector< uint32_t > *indices, std::vector< glm::vec3 > const &positions);
+
+//renumber vertices in order of first use:
+// rewrites indices and returns the new order of vertices (new vertex i is old vertex remap[i]);
+// vertices that aren't used by any triangle are dropped
+std::vector< uint32_t > optimize_vertex_fetch(std::vector< uint32_t > *indices, uint32_t vertex_count);
+
+struct VertexCacheStats {
+	float acmr = 0.0f; //average cache miss ratio: vertices transformed per triangle (0.5 is ideal for large meshes, 3 is worst)
+	float atvr = 0.0f; //average transform to vertex ratio: vertices transformed per vertex used (1 is ideal)
+};
+
+//simulate a FIFO vertex cache of 'cache_size' entries:
+VertexCacheStats analyze_vertex_cache(std::vector< uint32_t > const &indices, uint32_t vertex_count, uint32_t cache_size = 16);
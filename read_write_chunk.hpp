@@ -4,6 +4,9 @@
 #include <vector>
 #include <stdexcept>
 #include <cassert>
+#include <cstring>
+#include <string>
+#include <type_traits>
 
 //helper function that reads an array of structures preceded by a simple header:
 //Expected format:
@@ -63,3 +66,57 @@ void write_chunk(std::string const &magic, std::vector< T > const &from, std::os
 	to.write(reinterpret_cast< const char * >(&header), sizeof(header));
 	to.write(reinterpret_cast< const char * >(from.data()), from.size() * sizeof(T));
 }
+
+
+//read-only view of a chunk's elements, left in place in memory (e.g., a MappedFile):
+// (elements are copied out on access, since chunks aren't necessarily aligned)
+template< typename T >
+struct ChunkView {
+	char const *data = nullptr;
+	size_t count = 0;
+
+	size_t size() const { return count; }
+	T operator[](size_t i) const {
+		assert(i < count);
+		T ret;
+		std::memcpy(&ret, data + i * sizeof(T), sizeof(T));
+		return ret;
+	}
+};
+
+//helper function that checks a chunk in the same format as read_chunk without copying it:
+// reads from *at_ (advancing it past the chunk); 'end' is the end of the available data
+template< typename T >
+ChunkView< T > map_chunk(char const **at_, char const *end, std::string const &magic) {
+	static_assert(std::is_trivially_copyable< T >::value, "chunk elements are copied bytewise");
+	assert(at_);
+	auto &at = *at_;
+
+	struct ChunkHeader {
+		char magic[4] = {'\0', '\0', '\0', '\0'};
+		uint32_t size = 0;
+	};
+	static_assert(sizeof(ChunkHeader) == 8, "header is packed");
+
+	ChunkHeader header;
+	if (size_t(end - at) < sizeof(header)) {
+		throw std::runtime_error("Failed to read chunk header");
+	}
+	std::memcpy(&header, at, sizeof(header));
+	if (std::string(header.magic,4) != magic) {
+		throw std::runtime_error("Unexpected magic number in chunk");
+	}
+
+	if (header.size % sizeof(T) != 0) {
+		throw std::runtime_error("Size of chunk not divisible by element size");
+	}
+	if (size_t(end - at) - sizeof(header) < header.size) {
+		throw std::runtime_error("Failed to read chunk data.");
+	}
+
+	ChunkView< T > view;
+	view.data = at + sizeof(header);
+	view.count = header.size / sizeof(T);
+	at += sizeof(header) + header.size;
+	return view;
+}
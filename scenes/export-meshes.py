@@ -78,6 +78,17 @@ def add_meshes(from_collection):
 add_meshes(collection)
 #print("Added meshes from: ", did_collections)
 
+#levels of detail:
+# coarser versions of a mesh 'name' are meshes named 'name.lod1', 'name.lod2', ... (used by objects anywhere in the file;
+# e.g., in a collection that isn't exported). They are written along with the original (see MeshBuffer::lookup_lods).
+lod_pattern = re.compile(r'^(.*)\.lod[0-9]+$')
+names_to_write = set(map(lambda mesh: mesh.name, to_write))
+for obj in bpy.data.objects:
+	if obj.type != 'MESH' or obj.data in to_write: continue
+	m = lod_pattern.match(obj.data.name)
+	if m and m.group(1) in names_to_write:
+		to_write.add(obj.data)
+
 #set all collections visible: (so that meshes can be selected for triangulation)
 def set_visible(layer_collection):
 	layer_collection.exclude = False
@@ -196,7 +196,11 @@ def write_objects(from_collection):
 		if tuple(instance_parents + [obj]) in written: continue
 		written.add(tuple(instance_parents + [obj]))
 		if obj.type == 'MESH':
-			write_mesh(obj)
+			if re.match(r'^.*\.lod[0-9]+$', obj.data.name):
+				#(levels of detail are exported with the mesh they simplify, not as objects of their own)
+				print("Skipping level of detail '" + obj.name + "' / '" + obj.data.name + "'")
+			else:
+				write_mesh(obj)
 		elif obj.type == 'CAMERA':
 			write_camera(obj)
 		elif obj.type == 'LIGHT':
@@ -4,6 +4,7 @@
 #include "GL.hpp"
 #include "load_save_png.hpp"
 #include "ShowSceneProgram.hpp"
+#include "FileWatch.hpp"
 
 #include <SDL.h>
 
@@ -103,25 +104,44 @@ int main(int argc, char **argv) {
 			buffer = nullptr;
 		}
 	}
+	//makes drawables for meshes in the scene (used when loading and when reloading):
+	auto on_drawable = [&buffer,&buffer_vao](Scene &scene, Scene::Transform *transform, std::string const &mesh_name){
+		if (!buffer_vao) return;
+		Mesh const &mesh = buffer->lookup(mesh_name);
+		std::vector< Mesh const * > lods = buffer->lookup_lods(mesh_name);
+
+		scene.drawables.emplace_back(transform);
+		Scene::Drawable &drawable = scene.drawables.back();
+
+		drawable.pipeline = show_scene_program_pipeline;
+
+		drawable.pipeline.vao = buffer_vao;
+		drawable.pipeline.type = mesh.type;
+		drawable.pipeline.start = mesh.start;
+		drawable.pipeline.count = mesh.count;
+		drawable.pipeline.index_type = mesh.index_type;
+		drawable.pipeline.base_vertex = mesh.base_vertex;
+		drawable.pipeline.vertex_count = mesh.vertex_count;
+		drawable.pipeline.position_scale = mesh.position_scale;
+		drawable.pipeline.position_offset = mesh.position_offset;
+
+		//(bounds are used for occlusion culling and level of detail)
+		drawable.bounds_min = mesh.min;
+		drawable.bounds_max = mesh.max;
+		drawable.bounds_radius = mesh.radius;
+
+		//coarser levels of detail (if any were exported), each used below half the screen size of the one before:
+		std::vector< Scene::Drawable::LOD > levels;
+		for (uint32_t i = 0; i < lods.size(); ++i) {
+			levels.emplace_back(Scene::Drawable::LOD{lods[i]->start, lods[i]->count, 0.25f / float(1 << i), lods[i]->base_vertex, lods[i]->vertex_count, lods[i]->position_scale, lods[i]->position_offset});
+		}
+		if (!levels.empty()) drawable.lods = std::move(levels);
+	};
 	Scene *scene = nullptr;
 	if (scene_file != "") {
 		try {
 			scene = new Scene();
-			scene->load(scene_file, [&buffer,&buffer_vao](Scene &scene, Scene::Transform *transform, std::string const &mesh_name){
-				if (!buffer_vao) return;
-				Mesh const &mesh = buffer->lookup(mesh_name);
-
-				scene.drawables.emplace_back(transform);
-				Scene::Drawable &drawable = scene.drawables.back();
-
-				drawable.pipeline = show_scene_program_pipeline;
-
-				drawable.pipeline.vao = buffer_vao;
-				drawable.pipeline.type = mesh.type;
-				drawable.pipeline.start = mesh.start;
-				drawable.pipeline.count = mesh.count;
-
-			});
+			scene->load(scene_file, on_drawable);
 		} catch (std::exception &e) {
 			std::cerr << "ERROR loading scene '" << scene_file << "': " << e.what() << std::endl;
 			usage = true;
@@ -132,17 +152,49 @@ int main(int argc, char **argv) {
 		usage = true;
 	}
 	if (usage) {
-		std::cerr << "Usage:\n\t" << argv[0] << " <path/to/scene.scene> [path/to/meshes.pnct]" << std::endl;
+		std::cerr << "Usage:\n\t" << argv[0] << " <path/to/scene.scene> [path/to/meshes.pnct|.ipnct]" << std::endl;
 		return 1;
 	}
 	std::cout << "Showing scene from '" << scene_file << "' with";
 	if (meshes_file != "") {
 		std::cout << " meshes from '" << meshes_file << "'" << std::endl;
 	} else {
-		std::cout << " no meshes -- consider passing a '.pnct' file as the second argument." << std::endl;
+		std::cout << " no meshes -- consider passing a '.pnct' or '.ipnct' file as the second argument." << std::endl;
 	}
 	Mode::set_current(std::make_shared< ShowSceneMode >(*scene));
 
+	//------------ hot reload ------------
+
+	//when files are re-exported, patch the changes into the scene being shown:
+	Scene loaded = *scene; //scene as last loaded (changes are found by comparing a fresh load to this)
+	auto reload_scene = [&](){
+		try {
+			Scene fresh;
+			fresh.load(scene_file, on_drawable);
+			Scene::PatchStats stats = scene->patch(loaded, fresh);
+			loaded = fresh;
+			std::cout << "Reloaded '" << scene_file << "': changed " << stats.transforms << " transforms, "
+				<< stats.drawables << " drawables, " << stats.cameras << " cameras, " << stats.lights << " lights." << std::endl;
+		} catch (std::exception &e) {
+			std::cerr << "ERROR reloading scene '" << scene_file << "': " << e.what() << std::endl;
+		}
+	};
+
+	FileWatch watch;
+	watch.watch(scene_file, reload_scene);
+	if (buffer) {
+		watch.watch(meshes_file, [&](){
+			try {
+				uint32_t uploaded = buffer->reload(meshes_file);
+				std::cout << "Reloaded '" << meshes_file << "': uploaded " << uploaded << " meshes." << std::endl;
+			} catch (std::exception &e) {
+				std::cerr << "ERROR reloading mesh buffer '" << meshes_file << "': " << e.what() << std::endl;
+				return;
+			}
+			reload_scene(); //(mesh ranges may have moved, so drawables need updating)
+		});
+	}
+
 	//------------ main loop ------------
 
 	//this inline function will be called whenever the window is resized,
@@ -197,6 +249,9 @@ int main(int argc, char **argv) {
 			if (!Mode::current) break;
 		}
 
+		//check for re-exported files:
+		watch.poll();
+
 		{ //(2) call the current mode's "update" function to deal with elapsed time:
 			auto current_time = std::chrono::high_resolution_clock::now();
 			static auto previous_time = current_time;